@@ -1,3 +1,7 @@
 # Compile PLRModel
 
 g++ src/main.cpp -o bin/PLRModel
+
+# Compile the benchmarks
+
+g++ -O2 -march=native -pthread src/benchmark.cpp -o bin/PLRBenchmark
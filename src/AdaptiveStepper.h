@@ -0,0 +1,172 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ADAPTIVESTEPPER_H_
+#define ADAPTIVESTEPPER_H_
+
+/**
+ * Steps counted by an AdaptiveStepper since its last reset.
+ */
+class StepperStatistics {
+public:
+	long accepted;
+	long rejected;
+	long solves;		// model steps, three per attempt
+
+	StepperStatistics() { clear(); }
+
+	void clear() {
+		accepted = 0;
+		rejected = 0;
+		solves = 0;
+	}
+};
+
+/**
+ * Advances a delay model to frame times with steps of its own choice.
+ *
+ * Each attempt takes the step h once and as two steps of h/2, and the
+ * difference of the two diameters estimates the error of the step (step
+ * doubling). The two half steps are kept when the difference is within
+ * tolerance; otherwise the attempt is undone with removeLastPulse and
+ * retried with a shorter step. Under stable light the step grows up to
+ * maxStep.
+ *
+ * The error estimate cannot see a luminance change in the history: the
+ * models read the flux latency ms before their previous pulse, so a change
+ * reaches them only after the latency, and one recorded between two
+ * distant pulses would be smeared over the whole step. A change of more
+ * than 1% therefore restarts the steps from minStep, which records a sharp
+ * edge in the history, and again once its latency passed, with a step
+ * ending exactly there.
+ *
+ * The model must only be stepped through the stepper after reset. Each
+ * attempt first archives the oldest pulses the history needs to make room
+ * for it, so undoing the attempt loses none. The trace of the model, if
+ * any, only receives the two halves of the accepted attempts.
+ */
+class AdaptiveStepper {
+	PupilDynamicsModel * model;
+	float time;
+	float diameter;
+	float step;
+	float intensity;
+
+	// times at which the latest luminance changes reach the model
+	HistoryFifo<float, 64> onsets;
+
+	float tolerance;
+	float minStep;
+	float maxStep;
+
+	StepperStatistics statistics;
+
+public:
+	/** tolerance in mm per step, steps in ms */
+	AdaptiveStepper(float _tolerance = 0.001, float _minStep = 1, float _maxStep = 200) :
+		model(NULL), time(0), diameter(0), step(_minStep), intensity(-1),
+		tolerance(_tolerance), minStep(_minStep), maxStep(_maxStep) {}
+
+	/** Steps model from time, the time of its last pulse */
+	void reset(PupilDynamicsModel * _model, float _time) {
+		model = _model;
+		time = _time;
+		step = minStep;
+		intensity = -1;
+		onsets.clear();
+		statistics.clear();
+	}
+
+	/**
+	 * Diameter (mm) at frameTime, with the intensity and latency (ms) held
+	 * since the previous call, as in pupilDiameterAt(intensity, latency,
+	 * time). Returns the last diameter if frameTime is not after it by at
+	 * least a hundredth of minStep.
+	 */
+	float advanceTo(float frameTime, float frameIntensity, float latency) {
+		if (fabs(frameIntensity - intensity) > 0.01f * fabs(intensity)) {
+			step = minStep;
+			onsets.add(time + latency);
+		}
+		intensity = frameIntensity;
+
+		// a tiny step would take the models to their stationary solution
+		while (frameTime - time > 0.01f * minStep) {
+			while (!onsets.empty() && onsets.first() < time + minStep) {
+				onsets.removeFirst();
+				step = minStep;
+			}
+
+			// the last step of a frame and the step before an onset may be
+			// shortened, keep the chosen one
+			float end = frameTime;
+			if (!onsets.empty() && onsets.first() < end) end = onsets.first();
+			float h = std::min(step, end - time);
+			// no step shorter than minStep left before the end
+			if (end - time - h < minStep) h = end - time;
+			bool shortened = h < step;
+
+			PupilTraceWriter * trace = model->getTraceWriter();
+			if (trace != NULL) trace->hold();
+
+			while (true) {
+				model->reserveHistory(2);
+				float whole = model->pupilDiameterAt(intensity, latency, time + h);
+				model->removeLastPulse();
+				if (trace != NULL) trace->discard();
+				model->pupilDiameterAt(intensity, latency, time + h / 2);
+				float halves = model->pupilDiameterAt(intensity, latency, time + h);
+				statistics.solves += 3;
+
+				float error = fabs(halves - whole);
+				if (error <= tolerance || h <= minStep) {
+					statistics.accepted++;
+					time += h;
+					diameter = halves;
+					// local error grows with h^2 for a first order method
+					float grow = error > 0 ? 0.9f * sqrtf(tolerance / error) : 2;
+					if (!shortened || grow < 1) step = std::min(std::max(h * std::min(grow, 2.0f), minStep), maxStep);
+					if (trace != NULL) trace->commit();
+					break;
+				}
+
+				model->removeLastPulse();
+				model->removeLastPulse();
+				if (trace != NULL) trace->discard();
+				statistics.rejected++;
+				h = std::max(h * std::max(0.9f * sqrtf(tolerance / error), 0.25f), minStep);
+				shortened = false;
+			}
+		}
+		return diameter;
+	}
+
+	float getTime() const {
+		return time;
+	}
+
+	/** Step for the next attempt, in ms */
+	float getStep() const {
+		return step;
+	}
+
+	const StepperStatistics & getStatistics() const {
+		return statistics;
+	}
+};
+
+#endif /*ADAPTIVESTEPPER_H_*/
@@ -0,0 +1,333 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <new>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+/**
+ * Wall clock stopwatch used by the benchmark program.
+ */
+class BenchmarkTimer {
+	std::chrono::steady_clock::time_point start;
+
+public:
+	BenchmarkTimer() { restart(); }
+
+	void restart() {
+		start = std::chrono::steady_clock::now();
+	}
+
+	double elapsedSeconds() const {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+/**
+ * Keeps the optimizer from discarding a benchmarked result.
+ */
+template <class T>
+void doNotOptimize(const T & value) {
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+/**
+ * Timing loop of a benchmark registered in a BenchmarkSuite:
+ *
+ *	suite.add("history/push", [](BenchmarkState & state) {
+ *		HistoryFifo<PupilSample, 1000> history;
+ *		while (state.keepRunning()) history.add(...);
+ *	});
+ *
+ * The setup before the loop is not timed, nor is the work between
+ * pauseTiming and resumeTiming.
+ */
+class BenchmarkState {
+	long iterations;
+	long remaining;
+	bool started;
+
+	std::chrono::steady_clock::time_point start;
+	std::clock_t cpuStart;
+
+public:
+	double seconds;
+	double cpuSeconds;
+	double itemsPerIteration;
+	std::vector<std::pair<std::string, double> > counters;
+
+	BenchmarkState(long _iterations) :
+		iterations(_iterations), remaining(_iterations), started(false),
+		seconds(0), cpuSeconds(0), itemsPerIteration(1) {}
+
+	bool keepRunning() {
+		if (!started) {
+			started = true;
+			resumeTiming();
+		}
+		if (remaining > 0) {
+			remaining--;
+			return true;
+		}
+		pauseTiming();
+		return false;
+	}
+
+	void pauseTiming() {
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		cpuSeconds += (double) (std::clock() - cpuStart) / CLOCKS_PER_SEC;
+	}
+
+	void resumeTiming() {
+		start = std::chrono::steady_clock::now();
+		cpuStart = std::clock();
+	}
+
+	long getIterations() const {
+		return iterations;
+	}
+
+	/** Operations done by each iteration, such as pupils stepped; 1 by default */
+	void setItemsPerIteration(double items) {
+		itemsPerIteration = items;
+	}
+
+	/** Reported along the timings, such as solver iterations per step */
+	void setCounter(const std::string & name, double value) {
+		counters.push_back(std::make_pair(name, value));
+	}
+};
+
+/**
+ * Timing of one benchmark: the operations and their wall and processor
+ * times, the latter negative when unknown.
+ */
+class BenchmarkResult {
+public:
+	std::string name;
+	double operations;
+	double seconds;
+	double cpuSeconds;
+	std::vector<std::pair<std::string, double> > counters;
+};
+
+/**
+ * Registered benchmarks and the results of every benchmark run by the
+ * program, written as Google Benchmark JSON to track regressions.
+ *
+ * Each benchmark runs with 1, then more iterations until its timed loop
+ * lasts minSeconds, as Google Benchmark does.
+ */
+class BenchmarkSuite {
+	class Benchmark {
+	public:
+		std::string name;
+		std::function<void(BenchmarkState &)> function;
+	};
+
+	std::vector<Benchmark> benchmarks;
+	std::vector<BenchmarkResult> results;
+	double minSeconds;
+
+public:
+	BenchmarkSuite() : minSeconds(0.1) {}
+
+	/** Suite of the benchmark program, created on first use */
+	static BenchmarkSuite & global() {
+		static BenchmarkSuite suite;
+		return suite;
+	}
+
+	void setMinSeconds(double v) {
+		minSeconds = v;
+	}
+
+	void add(const std::string & name, std::function<void(BenchmarkState &)> function) {
+		Benchmark benchmark = { name, function };
+		benchmarks.push_back(benchmark);
+	}
+
+	int size() const {
+		return benchmarks.size();
+	}
+
+	/** Runs the benchmarks whose name contains filter */
+	void run(const std::string & filter) {
+		for (unsigned int b=0; b<benchmarks.size(); b++) {
+			if (benchmarks[b].name.find(filter) == std::string::npos) continue;
+
+			long iterations = 1;
+			while (true) {
+				BenchmarkState state(iterations);
+				benchmarks[b].function(state);
+
+				if (state.seconds >= minSeconds || iterations >= 1000000000L) {
+					BenchmarkResult result = { benchmarks[b].name, iterations * state.itemsPerIteration,
+					                           state.seconds, state.cpuSeconds, state.counters };
+					record(result);
+					break;
+				}
+
+				double multiplier = state.seconds > 0 ? minSeconds * 1.4 / state.seconds : 10;
+				iterations = std::max(iterations + 1, (long) (iterations * std::min(multiplier, 10.0)));
+			}
+		}
+	}
+
+	/** Prints result and keeps it for writeJson */
+	void record(const BenchmarkResult & result) {
+		results.push_back(result);
+
+		std::cout << result.name << ": "
+		          << result.operations / result.seconds << " ops/s, "
+		          << result.seconds * 1.0e9 / result.operations << " ns/op";
+		for (unsigned int c=0; c<result.counters.size(); c++) {
+			std::cout << ", " << result.counters[c].first << " " << result.counters[c].second;
+		}
+		std::cout << std::endl;
+	}
+
+	const std::vector<BenchmarkResult> & getResults() const {
+		return results;
+	}
+
+	/**
+	 * Every result so far in the format of Google Benchmark's
+	 * --benchmark_format=json: times are in ns per operation.
+	 */
+	void writeJson(std::ostream & out) const {
+		char date[32];
+		std::time_t now = std::time(NULL);
+		std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+		char host[256] = "";
+		gethostname(host, sizeof(host) - 1);
+
+		out << "{\n  \"context\": {\n"
+		    << "    \"date\": \"" << date << "\",\n"
+		    << "    \"host_name\": " << quoted(host) << ",\n"
+		    << "    \"executable\": \"PLRBenchmark\",\n"
+		    << "    \"num_cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << ",\n"
+#ifdef __OPTIMIZE__
+		    << "    \"library_build_type\": \"release\",\n"
+#else
+		    << "    \"library_build_type\": \"debug\",\n"
+#endif
+#ifdef PLR_SIMD
+		    << "    \"float_pack_width\": " << FLOAT_PACK_WIDTH << "\n"
+#else
+		    << "    \"float_pack_width\": 1\n"
+#endif
+		    << "  },\n  \"benchmarks\": [";
+
+		for (unsigned int r=0; r<results.size(); r++) {
+			const BenchmarkResult & result = results[r];
+			out << (r == 0 ? "\n" : ",\n")
+			    << "    {\n"
+			    << "      \"name\": " << quoted(result.name) << ",\n"
+			    << "      \"run_name\": " << quoted(result.name) << ",\n"
+			    << "      \"run_type\": \"iteration\",\n"
+			    << "      \"iterations\": " << (long) result.operations << ",\n"
+			    << "      \"real_time\": " << result.seconds * 1.0e9 / result.operations << ",\n";
+			if (result.cpuSeconds >= 0) {
+				out << "      \"cpu_time\": " << result.cpuSeconds * 1.0e9 / result.operations << ",\n";
+			}
+			out << "      \"time_unit\": \"ns\",\n"
+			    << "      \"items_per_second\": " << result.operations / result.seconds;
+			for (unsigned int c=0; c<result.counters.size(); c++) {
+				out << ",\n      " << quoted(result.counters[c].first) << ": " << result.counters[c].second;
+			}
+			out << "\n    }";
+		}
+		out << "\n  ]\n}\n";
+	}
+
+private:
+	static std::string quoted(const std::string & text) {
+		std::string json = "\"";
+		for (unsigned int i=0; i<text.size(); i++) {
+			if (text[i] == '"' || text[i] == '\\') json += '\\';
+			if ((unsigned char) text[i] >= 0x20) json += text[i];
+		}
+		return json + "\"";
+	}
+};
+
+/**
+ * Prints the throughput of *operations* executed in *seconds*, and keeps
+ * it for the JSON report.
+ */
+void reportBenchmark(const std::string & name, double operations, double seconds) {
+	BenchmarkResult result = { name, operations, seconds, -1, {} };
+	BenchmarkSuite::global().record(result);
+}
+
+/**
+ * Counts the calls to the global operator new of the benchmark program, to
+ * check that the hot paths do not allocate.
+ */
+class AllocationCounter {
+public:
+	static long & count() {
+		static thread_local long allocations = 0;
+		return allocations;
+	}
+};
+
+void * operator new(std::size_t size) {
+	AllocationCounter::count()++;
+	void * p = std::malloc(size == 0 ? 1 : size);
+	if (p == NULL) throw std::bad_alloc();
+	return p;
+}
+
+void * operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+// kept out of line: gcc warns when it sees free() on memory from operator new
+__attribute__((noinline)) void releaseAllocation(void * p) {
+	std::free(p);
+}
+
+void operator delete(void * p) noexcept {
+	releaseAllocation(p);
+}
+
+void operator delete[](void * p) noexcept {
+	releaseAllocation(p);
+}
+
+void operator delete(void * p, std::size_t) noexcept {
+	releaseAllocation(p);
+}
+
+void operator delete[](void * p, std::size_t) noexcept {
+	releaseAllocation(p);
+}
+
+#endif /*BENCHMARK_H_*/
@@ -0,0 +1,127 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <type_traits>
+
+/**
+ * Appends the fields of a model state to a binary blob, in native byte
+ * order.
+ */
+class CheckpointWriter {
+	std::vector<char> & blob;
+
+public:
+	CheckpointWriter(std::vector<char> & _blob) : blob(_blob) {}
+
+	template <class T>
+	void write(const T & value) {
+		size_t size = blob.size();
+		blob.resize(size + sizeof(T));
+		memcpy(&blob[size], &value, sizeof(T));
+	}
+
+	/** Entry count followed by the bytes of every entry */
+	template <class Fifo>
+	void writeHistory(const Fifo & fifo) {
+		write((int32_t) fifo.size());
+		for (int i=0; i<fifo.size(); i++) {
+			write(fifo[i]);
+		}
+	}
+
+	size_t size() const {
+		return blob.size();
+	}
+};
+
+/**
+ * Reads back the fields written by CheckpointWriter. A read past the end
+ * of the blob fails, and so do all the following ones.
+ */
+class CheckpointReader {
+	const char * cursor;
+	const char * end;
+	bool failed;
+
+public:
+	CheckpointReader(const char * data, size_t size) : cursor(data), end(data + size), failed(false) {}
+
+	template <class T>
+	bool read(T & value) {
+		if (failed || (size_t) (end - cursor) < sizeof(T)) {
+			failed = true;
+			return false;
+		}
+		memcpy(&value, cursor, sizeof(T));
+		cursor += sizeof(T);
+		return true;
+	}
+
+	/**
+	 * Replaces the entries of fifo. The fifo is left untouched if the
+	 * history does not fit in it or in the blob.
+	 */
+	template <class Fifo>
+	bool readHistory(Fifo & fifo) {
+		int32_t count;
+		if (!read(count)) return false;
+
+		typedef typename std::remove_const<typename std::remove_reference<decltype(fifo[0])>::type>::type Entry;
+		static_assert(std::is_trivially_copyable<Entry>::value, "history entries are copied as bytes");
+
+		size_t entrySize = sizeof(Entry);
+		if (count < 0 || count > fifo.capacity() || (size_t) (end - cursor) < count * entrySize) {
+			failed = true;
+			return false;
+		}
+
+		fifo.clear();
+		for (int i=0; i<count; i++) {
+			fifo.add(Entry());
+			memcpy(&fifo[i], cursor, entrySize);
+			cursor += entrySize;
+		}
+		return true;
+	}
+
+	bool ok() const {
+		return !failed;
+	}
+
+	size_t remaining() const {
+		return end - cursor;
+	}
+
+	/** An enum field read as value, from its first enumerator to last */
+	static bool isEnum(int64_t value, int last) {
+		return value >= 0 && value <= last;
+	}
+
+	/** A field that must be finite and above 0, as a step or a threshold */
+	static bool isPositive(double value) {
+		return std::isfinite(value) && value > 0;
+	}
+};
+
+#endif /*CHECKPOINT_H_*/
@@ -46,6 +46,25 @@ public:
 	virtual float pupilDiameterWithMillilamberts(float lightIntensity) {
 		return powf(10, 0.8558 -0.000401 * powf(log10(lightIntensity)+8.1, 3));
 	} 	
+
+	/**
+	 * Intensities in Blondels
+	 */
+	virtual void pupilDiameterAt(const float * intensities, float * diameters, size_t n) {
+		size_t i = 0;
+#ifdef PLR_SIMD
+		// log10 of the conversion to millilamberts is -1: 8.1 - 1
+		for (; i + FLOAT_PACK_WIDTH <= n; i += FLOAT_PACK_WIDTH) {
+			FloatPack intensity = FloatPack::load(intensities + i);
+			FloatPack x = log10(intensity) + FloatPack(7.1f);
+			FloatPack diameter = exp10(FloatPack(0.8558f) - FloatPack(0.000401f)*x*x*x);
+			diameter.store(diameters + i);
+		}
+#endif
+		for (; i < n; i++) {
+			diameters[i] = DegrootAndGebhardModel::pupilDiameterAt(intensities[i]);
+		}
+	}
 };
 
 #endif /*MOONANDSPENCERMODEL_H_*/
@@ -0,0 +1,170 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DELAYLOOKUP_H_
+#define DELAYLOOKUP_H_
+
+enum DelayInterpolation {
+	LINEAR_DELAY,
+	HERMITE_DELAY
+};
+
+/**
+ * Intensity and pupil area of a delay model's history at a past time,
+ * shared by the delay models.
+ *
+ * The entry bracketing a time is the newest one at or before it (inclusive)
+ * or strictly before it. Consecutive lookups land next to each other, so the
+ * lookup remembers the sequence number of its last bracket and walks from
+ * there; it only falls back to a binary search after a jump.
+ *
+ * LINEAR_DELAY interpolates the bracketing pair. Entries closer than
+ * 0.01 ms give the newer one the weight coincidentWeight. HERMITE_DELAY
+ * interpolates the four entries around the time with a cubic whose
+ * Fritsch-Butland tangents keep it monotone between entries: it does not
+ * overshoot a luminance step, so the flux stays positive.
+ *
+ * Times older than the history are read from the model's HistoryArchive,
+ * when given one.
+ */
+template <int limit>
+class DelayLookup {
+	bool inclusive;
+	float coincidentWeight;
+	DelayInterpolation interpolation;
+
+	// sequence number of the last bracketing entry, -1 for none
+	long cursor;
+
+	static const int MAX_WALK = 8;
+
+	bool isBracket(float entryTime, double time) const {
+		return inclusive ? entryTime <= time : entryTime < time;
+	}
+
+public:
+	DelayLookup(bool _inclusive, float _coincidentWeight) :
+		inclusive(_inclusive), coincidentWeight(_coincidentWeight), interpolation(LINEAR_DELAY), cursor(-1) {}
+
+	void setInterpolation(DelayInterpolation v) {
+		interpolation = v;
+	}
+
+	DelayInterpolation getInterpolation() const {
+		return interpolation;
+	}
+
+	/**
+	 * Index of the entry bracketing time, -1 if all entries are newer.
+	 * The same as HistoryFifo::lastIndexAtOrBefore or lastIndexBefore.
+	 */
+	int find(const HistoryFifo<PupilSample, limit> & history, double time) {
+		int count = history.size();
+		long i = cursor < 0 ? -1 : history.indexOf(cursor);
+
+		if (i < 0 || i >= count) {
+			i = search(history, time);
+		} else {
+			int walked = 0;
+			while (i >= 0 && !isBracket(history[i].time, time) && walked < MAX_WALK) { i--; walked++; }
+			while (i+1 < count && isBracket(history[i+1].time, time) && walked < MAX_WALK) { i++; walked++; }
+			if (walked == MAX_WALK) i = search(history, time);
+		}
+
+		cursor = i < 0 ? -1 : history.sequence(i);
+		return i;
+	}
+
+	/**
+	 * Intensity and pupil area of the history at time, or of the archive
+	 * if the history starts after time. Returns false, leaving them
+	 * untouched, if neither reaches that far.
+	 */
+	bool sample(const HistoryFifo<PupilSample, limit> & history, double time, float & intensity, float & area,
+	            const HistoryArchive * archive = NULL) {
+		if (archive != NULL && (history.empty() || !isBracket(history.first().time, time))) {
+			return archive->sample(time, history.empty() ? NULL : &history.first(), intensity, area);
+		}
+
+		int i = find(history, time);
+		if (i < 0) return false;
+
+		int last = history.size() - 1;
+		const PupilSample & current = history[i];
+		const PupilSample & next = i < last ? history[i+1] : current;
+
+		float deltaTime = next.time - current.time;
+		float rest = time - current.time;
+
+		if (interpolation == HERMITE_DELAY && i < last && fabs(deltaTime) > 0.01) {
+			const PupilSample & previous = i > 0 ? history[i-1] : current;
+			const PupilSample & afterNext = i+1 < last ? history[i+2] : next;
+			float s = rest / deltaTime;
+			intensity = hermite(previous, current, next, afterNext, &PupilSample::intensity, s);
+			area = hermite(previous, current, next, afterNext, &PupilSample::area, s);
+			return true;
+		}
+
+		float percent = coincidentWeight;
+		if (fabs(deltaTime) > 0.01)
+			percent = rest / deltaTime;
+
+		// linear filter
+		intensity = current.intensity + (next.intensity - current.intensity) * percent;
+		area      = current.area + (next.area - current.area) * percent;
+		return true;
+	}
+
+	/** intensity * area at time, 0 if neither the history nor the archive reach it */
+	float flux(const HistoryFifo<PupilSample, limit> & history, double time, const HistoryArchive * archive = NULL) {
+		float intensity, area;
+		if (!sample(history, time, intensity, area, archive)) return 0;
+		return intensity * area;
+	}
+
+private:
+	int search(const HistoryFifo<PupilSample, limit> & history, double time) const {
+		return inclusive ? history.lastIndexAtOrBefore(time) : history.lastIndexBefore(time);
+	}
+
+	/** Fritsch-Butland tangent at b, between the secants from a and to c */
+	static float tangent(const PupilSample & a, const PupilSample & b, const PupilSample & c, float PupilSample::* k) {
+		float h0 = b.time - a.time;
+		float h1 = c.time - b.time;
+		if (h0 <= 0.01f) return h1 > 0.01f ? (c.*k - b.*k) / h1 : 0;
+		if (h1 <= 0.01f) return (b.*k - a.*k) / h0;
+
+		float d0 = (b.*k - a.*k) / h0;
+		float d1 = (c.*k - b.*k) / h1;
+		if (d0 * d1 <= 0) return 0;
+		return 3 * (h0 + h1) / ((2*h1 + h0) / d0 + (h1 + 2*h0) / d1);
+	}
+
+	/** Field k at the fraction s of the way from b to c */
+	static float hermite(const PupilSample & a, const PupilSample & b, const PupilSample & c, const PupilSample & d, float PupilSample::* k, float s) {
+		float h = c.time - b.time;
+		float mb = tangent(a, b, c, k) * h;
+		float mc = tangent(b, c, d, k) * h;
+
+		float s2 = s * s;
+		float s3 = s2 * s;
+		return (2*s3 - 3*s2 + 1) * b.*k + (s3 - 2*s2 + s) * mb
+		     + (-2*s3 + 3*s2) * c.*k + (s3 - s2) * mc;
+	}
+};
+
+#endif /*DELAYLOOKUP_H_*/
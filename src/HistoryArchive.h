@@ -0,0 +1,145 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HISTORYARCHIVE_H_
+#define HISTORYARCHIVE_H_
+
+/**
+ * Decimated copy of the pulses a delay model's history no longer holds, so
+ * the delayed flux can be read whatever the step: at 0.25 ms steps the
+ * 1000 pulses of the history span 250 ms, less than the latency in dim
+ * light.
+ *
+ * The pulses dropped by the history are averaged into buckets of
+ * BUCKET_MILLISECONDS. The buckets dropped by a full tier are averaged,
+ * FACTOR at a time, into the next one. The two tiers span 1 s at 4 ms and
+ * 8 s more at 32 ms, in 6 KB, for any step. A lookup is a binary search
+ * in a tier, and linear between the buckets around the time; the pulses
+ * of a bucket still being filled are not read.
+ */
+class HistoryArchive {
+public:
+	static const int TIERS = 2;
+	static const int BUCKETS = 256;
+	static const int FACTOR = 8;
+	static constexpr float BUCKET_MILLISECONDS = 4;
+
+private:
+	/** Sums of the pulses of the bucket being filled */
+	class PendingBucket {
+	public:
+		double time, intensity, area;
+		float start;
+		int32_t count;
+	};
+
+	HistoryFifo<PupilSample, BUCKETS> tiers[TIERS];
+	PendingBucket pending[TIERS];
+
+	void accumulate(int tier, const PupilSample & sample) {
+		PendingBucket & bucket = pending[tier];
+		if (bucket.count == 0) bucket.start = sample.time;
+		bucket.time += sample.time;
+		bucket.intensity += sample.intensity;
+		bucket.area += sample.area;
+		bucket.count++;
+	}
+
+	void flush(int tier) {
+		PendingBucket & bucket = pending[tier];
+		HistoryFifo<PupilSample, BUCKETS> & fifo = tiers[tier];
+		if (fifo.size() == fifo.capacity() && tier + 1 < TIERS) {
+			accumulate(tier + 1, fifo.first());
+			if (pending[tier + 1].count == FACTOR) flush(tier + 1);
+		}
+		fifo.add(PupilSample(bucket.time / bucket.count, bucket.intensity / bucket.count, bucket.area / bucket.count));
+		bucket = PendingBucket();
+	}
+
+public:
+	HistoryArchive() {
+		clear();
+	}
+
+	void clear() {
+		for (int t=0; t<TIERS; t++) {
+			tiers[t].clear();
+			pending[t] = PendingBucket();
+		}
+	}
+
+	/** Archives the oldest pulse of the history, before it is dropped */
+	void add(const PupilSample & sample) {
+		if (pending[0].count > 0 && sample.time - pending[0].start >= BUCKET_MILLISECONDS) flush(0);
+		accumulate(0, sample);
+	}
+
+	/** Buckets held by each tier */
+	int size(int tier) const {
+		return tiers[tier].size();
+	}
+
+	/**
+	 * Intensity and pupil area at time, between the archived buckets or
+	 * between the newest bucket and newest, the oldest pulse of the
+	 * history. Times before the oldest bucket take its values. Returns
+	 * false, leaving them untouched, if no bucket is archived.
+	 */
+	bool sample(double time, const PupilSample * newest, float & intensity, float & area) const {
+		const PupilSample * newer = newest;
+		for (int t=0; t<TIERS; t++) {
+			const HistoryFifo<PupilSample, BUCKETS> & fifo = tiers[t];
+			if (fifo.empty()) continue;
+
+			int i = fifo.lastIndexAtOrBefore(time);
+			if (i >= 0) {
+				const PupilSample & current = fifo[i];
+				const PupilSample & next = i + 1 < fifo.size() ? fifo[i+1] : (newer != NULL ? *newer : current);
+
+				float deltaTime = next.time - current.time;
+				float percent = deltaTime > 0.01f ? (time - current.time) / deltaTime : 1;
+				intensity = current.intensity + (next.intensity - current.intensity) * percent;
+				area      = current.area + (next.area - current.area) * percent;
+				return true;
+			}
+			newer = &fifo.first();
+		}
+
+		if (newer == newest) return false;
+		intensity = newer->intensity;
+		area = newer->area;
+		return true;
+	}
+
+	/** Buckets and the sums of the buckets being filled */
+	void saveState(CheckpointWriter & out) const {
+		for (int t=0; t<TIERS; t++) {
+			out.write(pending[t]);
+			out.writeHistory(tiers[t]);
+		}
+	}
+
+	bool restoreState(CheckpointReader & in) {
+		for (int t=0; t<TIERS; t++) {
+			in.read(pending[t]);
+			if (!in.ok() || !in.readHistory(tiers[t]) || pending[t].count < 0) return false;
+		}
+		return true;
+	}
+};
+
+#endif /*HISTORYARCHIVE_H_*/
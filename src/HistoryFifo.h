@@ -1,35 +1,156 @@
 #ifndef HISTORYFIFO_H_
 #define HISTORYFIFO_H_
 
-#include <vector> 
+#include <vector>
 
 /**
- * Storage for pupil size and intensity. 
+ * Time stamp of a history entry. Entries store the time in the first coordinate.
+ */
+template <class C, int N>
+inline double historyTime(const Vector<C,N> & value) {
+	return value[0];
+}
+
+/**
+ * Storage for pupil size and intensity.
  * This is used in the *delay* differential equation
+ *
+ * Fixed capacity circular buffer: once it holds *limit* entries, adding a new
+ * one drops the oldest in constant time. Index 0 is the oldest entry and
+ * size()-1 the newest one. Entries must be added in time order.
+ *
+ * Every entry also has a sequence number that does not change when older
+ * entries are dropped, see sequence().
  */
 template <class T, int limit>
 class HistoryFifo {
-			
+	std::vector<T> items;
+
+	// position of the oldest entry inside items
+	int start;
+	int count;
+
+	// entries added minus the ones removed from the end
+	long added;
+
+	inline int position(int index) const {
+		int pos = start + index;
+		if (pos >= limit) pos -= limit;
+		return pos;
+	}
+
 public:
-	std::vector<T> history;
-	
-	HistoryFifo() {}
+	HistoryFifo() : items(limit), start(0), count(0), added(0) {}
 	virtual ~HistoryFifo() {}
-	
+
 	void add(T value) {
-		history.push_back(value);
-		if (history.size()>limit) {
-			history.erase(history.begin());
+		added++;
+		if (count < limit) {
+			items[position(count)] = value;
+			count++;
+		} else {
+			items[start] = value;
+			start++;
+			if (start == limit) start = 0;
+		}
+	}
+
+	int size() const {
+		return count;
+	}
+
+	int capacity() const {
+		return limit;
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	void clear() {
+		start = 0;
+		count = 0;
+	}
+
+	/** Drops the oldest entry */
+	void removeFirst() {
+		start++;
+		if (start == limit) start = 0;
+		count--;
+	}
+
+	/** Drops the newest entry */
+	void removeLast() {
+		count--;
+		added--;
+	}
+
+	/** Sequence number of the entry at index, which may not be held yet */
+	long sequence(int index) const {
+		return added - count + index;
+	}
+
+	/** Index of the entry with a sequence number, out of [0, size()) if dropped */
+	long indexOf(long sequenceNumber) const {
+		return sequenceNumber - (added - count);
+	}
+
+	T & operator [] (int index) {
+		return items[position(index)];
+	}
+
+	const T & operator [] (int index) const {
+		return items[position(index)];
+	}
+
+	T & first() {
+		return items[start];
+	}
+
+	const T & first() const {
+		return items[start];
+	}
+
+	T & last() {
+		return items[position(count-1)];
+	}
+
+	const T & last() const {
+		return items[position(count-1)];
+	}
+
+	/**
+	 * Binary search for the newest entry whose time is <= time.
+	 * Returns -1 if all entries are newer.
+	 */
+	int lastIndexAtOrBefore(double time) const {
+		int low = 0;
+		int high = count;
+		while (low < high) {
+			int middle = (low + high) / 2;
+			if (time < historyTime(items[position(middle)]))
+				high = middle;
+			else
+				low = middle + 1;
 		}
+		return low - 1;
 	}
-	
-	
-	int size() {
-		return history.size();
-	}	
-	
-	T operator [] (int index) {
-		history[index];
+
+	/**
+	 * Binary search for the newest entry whose time is < time.
+	 * Returns -1 if all entries are at or after time.
+	 */
+	int lastIndexBefore(double time) const {
+		int low = 0;
+		int high = count;
+		while (low < high) {
+			int middle = (low + high) / 2;
+			if (time > historyTime(items[position(middle)]))
+				low = middle + 1;
+			else
+				high = middle;
+		}
+		return low - 1;
 	}
 };
 
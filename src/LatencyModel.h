@@ -37,8 +37,17 @@ public:
 	virtual float pupilLatencyAt(float intensity) {
 		return 0;
 	}
+
+	/**
+	 * Latencies (ms) of n intensities at once.
+	 */
+	virtual void pupilLatencyAt(const float * intensities, float * latencies, size_t n) {
+		for (size_t i=0; i<n; i++) {
+			latencies[i] = pupilLatencyAt(intensities[i]);
+		}
+	}
 	
-	std::string getName() {
+	const std::string & getName() const {
 		return name;
 	}
 	
@@ -11,7 +11,10 @@ class LongtinAndMiltonModel : public PupilDynamicsModel {
 	// x = time (milliseconds) , 
 	// y = intensity (lumens), 
 	// z = pupil area (mm ^2).
-	HistoryFifo<Vector3f, 1000> history;
+	HistoryFifo<PupilSample, 1000> history;
+
+	// pulses dropped by history, for latencies longer than it spans
+	HistoryArchive archive;
 	
 	float gamma;
 	float minimumThreshold;
@@ -21,15 +24,90 @@ class LongtinAndMiltonModel : public PupilDynamicsModel {
 	float theta;
 	float dt;
 	float n;
+
+	SolverType solver;
+	bool lookupTables;
+
+	// delayed intensity and area, newest entry strictly before the time
+	DelayLookup<1000> delay;
 	
 public:
-	LongtinAndMiltonModel(float _gamma, float _minimumThreshold) : PupilDynamicsModel("Longtin And Milton") {
+	/**
+	 * Left side minus right side of the model as a function of dA, for
+	 * RootFinder. Decreases with dA.
+	 */
+	class HillEquation {
+	public:
+		double prevArea;
+		double prevG;
+		double dT;
+		double rightSide;
+		double alpha;
+		double minArea;
+		double maxArea;
+		double theta;
+		double n;
+		// hillFunctionInverse from LookupTables
+		bool lookupTables;
+
+		HillEquation(LongtinAndMiltonModel & model, double _prevArea, double _dT, double _rightSide) {
+			alpha = model.alpha;
+			minArea = model.minArea;
+			maxArea = model.maxArea;
+			theta = model.theta;
+			n = model.n;
+			lookupTables = model.lookupTables && TabulatedFunctions::isDefaultHill(model.minArea, model.maxArea, model.theta, model.n);
+
+			// the inverse Hill function is only finite inside (minArea, minArea + maxArea)
+			double margin = maxArea * 1.0e-6;
+			prevArea = std::min(std::max(_prevArea, minArea + margin), minArea + maxArea - margin);
+
+			double derivative;
+			inverseHill(prevArea, prevG, derivative);
+			dT = _dT;
+			rightSide = _rightSide;
+		}
+
+		/**
+		 * hillFunctionInverse written as theta * (maxArea / (area - minArea) - 1)^(1/n)
+		 * and its derivative.
+		 */
+		void inverseHill(double area, double & g, double & dGdA) {
+			double open = area - minArea;
+
+			if (lookupTables && LookupTables::hillInverseTable().contains(area))
+				g = LookupTables::hillInverseTable().at(area);
+			else
+				g = theta * pow(maxArea / open - 1, 1.0 / n);
+
+			dGdA = -g * maxArea / (n * open * (maxArea - open));
+		}
+
+		void evaluate(double dA, double & value, double & derivative) {
+			double g, dGdA;
+			inverseHill(prevArea + dA, g, dGdA);
+
+			if (fabs(dT) <= 0.0001) {
+				value = -54.0 + alpha * g - rightSide;
+				derivative = alpha * dGdA;
+				return;
+			}
+
+			value = (g - prevG)/dT + -54.0 + alpha * g - rightSide;
+			derivative = dGdA * (1/dT + alpha);
+		}
+
+		double lowestDA() const { return minArea - prevArea; }
+		double highestDA() const { return minArea + maxArea - prevArea; }
+	};
+
+	LongtinAndMiltonModel(float _gamma, float _minimumThreshold) : PupilDynamicsModel("Longtin And Milton"), delay(false, 0) {
 		init();
 		gamma = _gamma;
 		minimumThreshold = _minimumThreshold;	
 	}
 		
-	LongtinAndMiltonModel(float _alpha, float _gamma, float _minimumThreshold) : PupilDynamicsModel("Longtin And Milton") {
+	LongtinAndMiltonModel(float _alpha, float _gamma, float _minimumThreshold) : PupilDynamicsModel("Longtin And Milton"), delay(false, 0) {
 		init ();
 
 		gamma = _gamma;
@@ -38,7 +116,7 @@ public:
 	}
 			
 	
-	LongtinAndMiltonModel() : PupilDynamicsModel("Longtin And Milton") {
+	LongtinAndMiltonModel() : PupilDynamicsModel("Longtin And Milton"), delay(false, 0) {
 		init ();
 	}
 
@@ -55,6 +133,8 @@ public:
 		theta = 10;
 		dt = 0.01;
 		n = 55;
+		solver = STEP_HALVING_SOLVER;
+		lookupTables = false;
 		
 
 		/*
@@ -71,9 +151,13 @@ public:
 	
 	virtual ~LongtinAndMiltonModel() {}
 	
-	HistoryFifo<Vector3f, 1000> getHistory() {
+	const HistoryFifo<PupilSample, 1000> & getHistory() const {
 		return history;
 	}
+
+	const HistoryArchive & getArchive() const {
+		return archive;
+	}
 	
 	float getGamma() {
 		return gamma;
@@ -130,13 +214,146 @@ public:
 	float getDt() {
 		return dt;
 	}	
-	
+
+	void setSolver(SolverType _solver) {
+		solver = _solver;
+	}
+
+	SolverType getSolver() {
+		return solver;
+	}
+
+	/**
+	 * Evaluates hillFunctionInverse with the table of LookupTables. Only
+	 * takes effect with the default minArea, maxArea, theta and n.
+	 */
+	void setLookupTables(bool v) {
+		lookupTables = v;
+	}
+
+	bool usesLookupTables() {
+		return lookupTables;
+	}
+
+	/** How the delayed flux is read between history entries, see DelayLookup */
+	void setDelayInterpolation(DelayInterpolation v) {
+		delay.setInterpolation(v);
+	}
+
+	DelayInterpolation getDelayInterpolation() {
+		return delay.getInterpolation();
+	}
+
+	/** Parameters, solver, tables, interpolation, archive and history */
+	void saveState(CheckpointWriter & out) const {
+		out.write(gamma);
+		out.write(minimumThreshold);
+		out.write(alpha);
+		out.write(minArea);
+		out.write(maxArea);
+		out.write(theta);
+		out.write(dt);
+		out.write(n);
+		out.write((int32_t) solver);
+		out.write((uint8_t) lookupTables);
+		out.write((uint8_t) delay.getInterpolation());
+		archive.saveState(out);
+		out.writeHistory(history);
+	}
+
+	bool restoreState(CheckpointReader & in) {
+		float parameters[8];
+		int32_t stateSolver;
+		uint8_t stateTables, stateInterpolation;
+
+		in.read(parameters);
+		in.read(stateSolver);
+		in.read(stateTables);
+		in.read(stateInterpolation);
+		if (!in.ok()) return false;
+		for (int i=0; i<8; i++) {
+			if (!std::isfinite(parameters[i])) return false;
+		}
+		// dt and the threshold
+		if (!CheckpointReader::isPositive(parameters[6]) || !CheckpointReader::isPositive(parameters[1])
+		    || !CheckpointReader::isEnum(stateSolver, NEWTON_SOLVER)
+		    || !CheckpointReader::isEnum(stateInterpolation, HERMITE_DELAY)) return false;
+
+		HistoryArchive stateArchive;
+		HistoryFifo<PupilSample, 1000> stateHistory;
+		if (!stateArchive.restoreState(in) || !in.readHistory(stateHistory) || in.remaining() != 0) return false;
+
+		gamma = parameters[0];
+		minimumThreshold = parameters[1];
+		alpha = parameters[2];
+		minArea = parameters[3];
+		maxArea = parameters[4];
+		theta = parameters[5];
+		dt = parameters[6];
+		n = parameters[7];
+		solver = (SolverType) stateSolver;
+		lookupTables = stateTables != 0;
+		delay.setInterpolation((DelayInterpolation) stateInterpolation);
+		archive = stateArchive;
+		history = stateHistory;
+		return true;
+	}
+
+	/**
+	 * Area (mm2) at which the model rests under blondels. Read from
+	 * LookupTables::longtinSteadyTable() for the default parameters, found by
+	 * bisection otherwise.
+	 */
+	float steadyArea(float blondels) {
+		if (TabulatedFunctions::isDefaultHill(minArea, maxArea, theta, n)
+		    && gamma == (float) TabulatedFunctions::LONGTIN_GAMMA
+		    && alpha == (float) TabulatedFunctions::LONGTIN_ALPHA
+		    && minimumThreshold == (float) TabulatedFunctions::LONGTIN_THRESHOLD)
+			return LookupTables::longtinSteadyTable().clampedAt(log10(blondels));
+
+		double logIntensity = log(Conversion::blondelToLumensSquareMillimeter(blondels));
+		double margin = maxArea * 1.0e-6;
+		double low = minArea + margin;
+		double high = minArea + maxArea - margin;
+		for (int i=0; i<40; i++) {
+			double area = (low + high) / 2;
+			double f = -54 + alpha * hillFunctionInverse(area) - gamma * (logIntensity + log(area / minimumThreshold));
+			if (f > 0) low = area; else high = area;
+		}
+		return (low + high) / 2;
+	}
+
+	/** 10 s of history at the steady area, see steadyArea */
+	void setSteadyState(float time, float blondels) {
+		float intensity = Conversion::blondelToLumensSquareMillimeter(blondels);
+		float area = steadyArea(blondels);
+
+		history.clear();
+		archive.clear();
+		for (int i=100; i>0; i--) {
+			addPulse(time - 100*i, intensity, area);
+		}
+	}
+
+	void removeLastPulse() {
+		if (history.size() > 1) history.removeLast();
+	}
+
+	void reserveHistory(int pulses) {
+		while (history.size() > 1 && history.size() > history.capacity() - pulses) {
+			archive.add(history.first());
+			history.removeFirst();
+		}
+	}
+
 	void addPulse(float mSeconds, float intensity, float area) {
+		if (area < minArea || area > maxArea + minArea) instrumentation.recordClamp();
 		if (area < minArea) area = minArea;
 		if (area > maxArea + minArea) area = maxArea + minArea;		
 		
 		if (area < 0.001) area = 1;
-		history.add(Vector3f(mSeconds, intensity, area));
+		if (history.size() == history.capacity()) archive.add(history.first());
+		history.add(PupilSample(mSeconds, intensity, area));
 	}
 	
 	/**
@@ -158,38 +375,8 @@ public:
 	 * 130
 	 */
 	float retinalFlux(float latencyInMilliseconds) {
-		int size = history.history.size()-1;
-		
-		double time = history.history[size].x();
-		double fromTime = time - latencyInMilliseconds;
-		
-		for (int i=size; i>=0; i--) {
-			if (fromTime > history.history[i].x()) {
-				Vector3f iAtual = history.history[i];
-				Vector3f iAnterior = history.history[i+1];
-
-				if (i == size)
-					iAnterior = iAtual;				
-				
-				float deltaTime = iAnterior.x() - iAtual.x();
-				float resto = fromTime - iAtual.x();
-				
-				float percent = 0;
-
-				if (fabs(deltaTime) > 0.01)
-					percent = resto / deltaTime;
-				
-				// linear filter
-				float intensity = iAtual.y() + (iAnterior.y() - iAtual.y()) * percent;
-				float area 		= iAtual.z() + (iAnterior.z() - iAtual.z()) * percent;
-
-				//std::cout << iAnterior.print() << " - " << iAtual.print() << std::endl;
-				
-				return retinalFlux(intensity, area);
-			}
-		}
-
-		return 0;
+		instrumentation.recordLookup();
+		return delay.flux(history, history.last().time - (double) latencyInMilliseconds, &archive);
 	}
 	
 	float logarithmOfRetinalFluxRate(float latency) {
@@ -218,15 +405,19 @@ public:
 		if (area < minArea) area = minArea;
 		if (area > maxArea + minArea) area = maxArea + minArea;
 
+		if (lookupTables && LookupTables::hillInverseTable().contains(area)
+		 && TabulatedFunctions::isDefaultHill(minArea, maxArea, theta, n))
+			return LookupTables::hillInverseTable().at(area);
+
 		long double powTethaN = pow(((long double)theta), ((long double) n));
 
 		return pow( (maxArea * powTethaN) / (area -minArea) - powTethaN , (long double) 1.0f/n);    
 	}
 	
 	float evaluateLeftSide(float time, float dA) {
-		//float dT = dt;//time - (history.history.end()-1)->x();
-		float dT = (time - (history.history.end()-1)->x()) / 540.0f;
-		float prevArea = history.history[history.history.size()-1].z();
+		//float dT = dt;//time - history.last().time;
+		float dT = (time - history.last().time) / 540.0f;
+		float prevArea = history.last().area;
 		
 		float hillFunc = hillFunctionInverse(prevArea + dA);
 		float dG = hillFunc - hillFunctionInverse(prevArea);
@@ -250,8 +441,31 @@ public:
 	 * 
 	 */ 
 	float evaluateArea(float latency, float time) {
-		float rightSide = neuralActionPotentialRate(latency);
+		float rightSide;
+		{
+			ScopedModelTimer timer(instrumentation, RIGHT_SIDE_TIMER);
+			rightSide = neuralActionPotentialRate(latency);
+		}
+		ScopedModelTimer timer(instrumentation, SOLVER_TIMER);
 		float leftSide;
+
+		if (solver == NEWTON_SOLVER) {
+			float dT = (time - history.last().time) / 540.0f;
+			HillEquation equation(*this, history.last().area, dT, rightSide);
+
+			double dA;
+			int iterations;
+			RootStatus status = RootFinder::solve(equation, equation.lowestDA(), equation.highestDA(), false, 0.0, 0.01, dA, iterations);
+
+			instrumentation.recordSolve(iterations);
+			if (status == ROOT_NOT_CONVERGED) instrumentation.recordUnconverged();
+
+			if (status == ROOT_FAILED) {
+				instrumentation.recordDivergence(time, history.last().area, rightSide);
+				return history.last().area;
+			}
+			return equation.prevArea + dA;
+		}
 		
 		float dA = 0;
 		float pass = 10.0f;
@@ -263,7 +477,8 @@ public:
 
 			// se encontrou o tamanho correto, retorne. 
 			if (equals(leftSide, rightSide, 0.01)) {
-				float prevArea = (history.history.end()-1)->z();
+				instrumentation.recordSolve(i+1);
+				float prevArea = history.last().area;
 				return prevArea+dA;
 			}
 			
@@ -285,7 +500,8 @@ public:
 						// se não tem como chegar lá.
 						if ((operation < 0 && leftSide > rightSide)
 						||  (operation > 0 && leftSide < rightSide)) {
-							float prevArea = (history.history.end()-1)->z();
+							instrumentation.recordSolve(i+1);
+							float prevArea = history.last().area;
 							return prevArea+dA;
 						}
 						
@@ -305,11 +521,11 @@ public:
 			leftSideAnt = leftSide;
 		}
 		
-		std::cout << "Não Convergiu" << std::endl;
-		std::cout << " dA: " << dA << "          \t pass: " << pass << "\t L: " << leftSide << "\t R: " << rightSide << std::endl;
+		instrumentation.recordSolve(100);
+		instrumentation.recordDivergence(time, history.last().area, rightSide);
 		
 		// caso não enco							ntre, retorne a área anterior.		
-		float prevArea = (history.history.end()-1)->z();
+		float prevArea = history.last().area;
 		return prevArea;
 	}
 	
@@ -325,15 +541,16 @@ public:
 	}
 	
 	float pupilDiameterAt(float intensity, float latency, float time) {
-		//std::cout << intensity << std::endl;
-		
+		ScopedModelTimer timer(instrumentation, STEP_TIMER);
+		instrumentation.recordStep();
 		float area = evaluateArea(latency, time);
 		
 		//area += gaussianError(time);
-		//std::cout << time << " " << gaussianError(time) << std::endl;
 		
 		addPulse(time,intensity, area);
-		return Conversion::areaToDiameter(area);
+		float diameter = Conversion::areaToDiameter(area);
+		trace(time, intensity, history.last().area, diameter, latency, instrumentation.lastIterations);
+		return diameter;
 	}
 	
 };
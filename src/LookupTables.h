@@ -0,0 +1,240 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOOKUPTABLES_H_
+#define LOOKUPTABLES_H_
+
+#include <cmath>
+
+/**
+ * Function sampled at N equally spaced points of [first, last], evaluated
+ * with linear interpolation. Sampled when constructed.
+ */
+template <int N>
+class LookupTable {
+public:
+	double first;
+	double last;
+	double scale;
+	float values[N];
+
+	LookupTable(double (*function)(double), double _first, double _last) :
+		first(_first), last(_last), scale((N - 1) / (_last - _first)), values() {
+		for (int i=0; i<N; i++) {
+			values[i] = function(first + i * (last - first) / (N - 1));
+		}
+	}
+
+	bool contains(float x) const {
+		return x >= first && x <= last;
+	}
+
+	/** Value at the nearest end outside of [first, last] */
+	float clampedAt(float x) const {
+		if (!(x > first)) return values[0];
+		if (x >= last) return values[N-1];
+		return at(x);
+	}
+
+	/** x must be inside [first, last] */
+	float at(float x) const {
+		float position = (x - first) * scale;
+		int i = (int) position;
+		if (i > N - 2) i = N - 2;
+
+		float fraction = position - i;
+		return values[i] + (values[i+1] - values[i]) * fraction;
+	}
+};
+
+/**
+ * Exact functions sampled by LookupTables.
+ */
+class TabulatedFunctions {
+public:
+	// Default parameters of LongtinAndMiltonModel. The Hill table is only
+	// valid for them.
+	static constexpr double HILL_MIN_AREA = 2.7000f;
+	static constexpr double HILL_MAX_AREA = 48.890f - 2.7000f;
+	static constexpr double HILL_THETA = 10;
+	static constexpr double HILL_N = 55;
+
+	// Other default parameters of LongtinAndMiltonModel, for its steady state
+	static constexpr double LONGTIN_GAMMA = 0.83f;
+	static constexpr double LONGTIN_ALPHA = 1/0.171;
+	static constexpr double LONGTIN_THRESHOLD = 4.8118f * 1.0e-10f;
+
+	static constexpr double LN10 = 2.302585092994045684018;
+
+	// Luminance of the dark adapted pupil, as in the phi bar of Pamplona's
+	// model, in blondels
+	static constexpr double DARK_BLONDELS = 1.0e-5;
+
+	// lumens/mm2 of a blondel, see Conversion
+	static constexpr double LUMENS_PER_BLONDEL = 0.1 * 0.00001;
+
+	/** m(D) of Pamplona's model */
+	static double m(double diameter) {
+		double x = (diameter - 4.9) / 3;
+		return 0.5 * (std::log(1+x) - std::log(1-x));
+	}
+
+	/** LongtinAndMiltonModel::hillFunctionInverse with the default parameters */
+	static double hillFunctionInverse(double area) {
+		return HILL_THETA * std::pow(HILL_MAX_AREA / (area - HILL_MIN_AREA) - 1, 1.0 / HILL_N);
+	}
+
+	/** PamplonaAndOliveiraWithEnvelopeModel::evaluateMoonUpperBound */
+	static double moonUpperBound(double d) {
+		return -0.0126725930676599 * d*d*d*d*d
+		     + 0.3221924543867559 * d*d*d*d
+		     + -3.0962731561456747 * d*d*d
+		     + 13.6546122786699637 * d*d
+		     + -25.3475379179258162 * d
+		     + 18.1791129454502212;
+	}
+
+	/** PamplonaAndOliveiraWithEnvelopeModel::evaluateMoonLowerBound */
+	static double moonLowerBound(double d) {
+		return -5.44158133181249E-3 * d*d*d*d*d
+		     + 1.38697487323348E-1 * d*d*d*d
+		     + -1.34343594792456 * d*d*d
+		     + 6.21951063864639 * d*d
+		     + -1.31667597501514E+1 * d
+		     + 1.21911721275106E+1;
+	}
+
+	/** MoonAndSpencerModel at log10 of the luminance in blondels */
+	static double moonDiameter(double logBlondels) {
+		return 4.9 - 3 * std::tanh(0.4 * (logBlondels - 0.5));
+	}
+
+	/**
+	 * Diameter (mm) at which Pamplona's model rests under a constant
+	 * luminance (log10 of blondels): 2.3025 m(D) = 5.2 - 0.45 ln(phi/phiBar)
+	 * with phi = I A(D) and phiBar the flux of a Moon and Spencer pupil at
+	 * DARK_BLONDELS. Newton's method from the Moon and Spencer diameter;
+	 * the left side minus the right side grows with D.
+	 */
+	static double pamplonaSteadyDiameter(double logBlondels) {
+		double darkDiameter = moonDiameter(std::log10(DARK_BLONDELS));
+		double logIntensityRate = (logBlondels - std::log10(DARK_BLONDELS)) * LN10;
+
+		double diameter = moonDiameter(logBlondels);
+		for (int i=0; i<8; i++) {
+			double x = (diameter - 4.9) / 3;
+			double f = 2.3025 * m(diameter) - 5.2 + 0.45 * (logIntensityRate + 2 * std::log(diameter / darkDiameter));
+			double derivative = 2.3025 * (1.0/3.0) / (1 - x*x) + 0.9 / diameter;
+			diameter -= f / derivative;
+			if (diameter < 1.9001) diameter = 1.9001;
+			if (diameter > 7.8999) diameter = 7.8999;
+		}
+		return diameter;
+	}
+
+	/**
+	 * Area (mm2) at which LongtinAndMiltonModel, with the default
+	 * parameters, rests under a constant luminance (log10 of blondels):
+	 * -54 + alpha g = gamma ln(I A / threshold), with A the Hill function
+	 * of g. Newton's method on g, as the left side minus the right side
+	 * grows with g at a rate of at least alpha.
+	 */
+	static double longtinSteadyArea(double logBlondels) {
+		double logRate = logBlondels * LN10 + std::log(LUMENS_PER_BLONDEL / LONGTIN_THRESHOLD);
+
+		double g = HILL_THETA;
+		double area = 0;
+		for (int i=0; i<12; i++) {
+			double ratio = std::pow(g / HILL_THETA, HILL_N);
+			area = HILL_MIN_AREA + HILL_MAX_AREA / (1 + ratio);
+			double dArea = -HILL_MAX_AREA * HILL_N * ratio / (g * (1 + ratio) * (1 + ratio));
+			double f = -54 + LONGTIN_ALPHA * g - LONGTIN_GAMMA * (logRate + std::log(area));
+			double derivative = LONGTIN_ALPHA - LONGTIN_GAMMA * dArea / area;
+			g -= f / derivative;
+			if (g < 1.0e-3) g = 1.0e-3;
+		}
+		return area;
+	}
+
+	static bool isDefaultHill(float minArea, float maxArea, float theta, float n) {
+		return minArea == (float) HILL_MIN_AREA && maxArea == (float) HILL_MAX_AREA
+		    && theta == (float) HILL_THETA && n == (float) HILL_N;
+	}
+};
+
+/**
+ * Tables of the functions evaluated at every solver iteration. Each table
+ * only covers the part of the physical range where linear interpolation is
+ * accurate; the models fall back to the exact function outside of it.
+ *
+ * With 4096 entries each, the measured interpolation errors are:
+ *   m(D), D in [2.05, 7.75] mm (|m| up to 1.83):      below 7e-6
+ *   Moon bounds, D in [1.85, 7.9] mm:                 below 2e-6 mm
+ *   inverse Hill, area in [3.2, 48.4] mm2 (g ~ 10):   below 2e-5
+ * against 1e-3 and 1e-2 of tolerance in the solvers.
+ *
+ * A table is sampled with the standard math functions on its first use,
+ * once per program, rather than at compile time: programs that never turn
+ * tables on neither compute them nor pay to compile them in every file
+ * that includes this header. The four solver tables take about 0.2 ms
+ * in all.
+ */
+class LookupTables {
+public:
+	static const int SIZE = 4096;
+
+	static const LookupTable<SIZE> & mTable() {
+		static const LookupTable<SIZE> table(&TabulatedFunctions::m, 2.05, 7.75);
+		return table;
+	}
+
+	static const LookupTable<SIZE> & hillInverseTable() {
+		static const LookupTable<SIZE> table(&TabulatedFunctions::hillFunctionInverse, 3.2, 48.4);
+		return table;
+	}
+
+	static const LookupTable<SIZE> & moonUpperTable() {
+		static const LookupTable<SIZE> table(&TabulatedFunctions::moonUpperBound, 1.85, 7.9);
+		return table;
+	}
+
+	static const LookupTable<SIZE> & moonLowerTable() {
+		static const LookupTable<SIZE> table(&TabulatedFunctions::moonLowerBound, 1.85, 7.9);
+		return table;
+	}
+
+	/**
+	 * Steady states over log10 of 1e-6 to 1e6 blondels, for the delay
+	 * models to start adapted to a luminance. The pupil saturates outside
+	 * of this range. The first setSteadyState of a program runs the Newton
+	 * sweep of its table, see the "steady" benchmark for the cost; later
+	 * spawns only interpolate.
+	 */
+	static const int STEADY_SIZE = 241;
+
+	static const LookupTable<STEADY_SIZE> & pamplonaSteadyTable() {
+		static const LookupTable<STEADY_SIZE> table(&TabulatedFunctions::pamplonaSteadyDiameter, -6, 6);
+		return table;
+	}
+
+	static const LookupTable<STEADY_SIZE> & longtinSteadyTable() {
+		static const LookupTable<STEADY_SIZE> table(&TabulatedFunctions::longtinSteadyArea, -6, 6);
+		return table;
+	}
+};
+
+#endif /*LOOKUPTABLES_H_*/
@@ -0,0 +1,115 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MODELCHECKPOINT_H_
+#define MODELCHECKPOINT_H_
+
+/**
+ * Binary snapshots of pupil models, to restore adapted pupils instead of
+ * stepping new ones until they adapt.
+ *
+ * A blob starts with a 12 byte header: the 4 bytes of MAGIC, the format
+ * VERSION and the kind of snapshot (uint16 each) and the size of the rest
+ * of the blob (uint32). A PUPIL_MODEL snapshot continues with the model id
+ * (uint8) and the fields of PupilDynamicsModel::saveState; PupilLifecycle
+ * writes LIFECYCLE snapshots. Fields are in native byte order.
+ */
+class ModelCheckpoint {
+public:
+	static constexpr const char * MAGIC = "PLRC";
+	static const uint16_t VERSION = 3;
+
+	static const uint16_t PUPIL_MODEL = 1;
+	static const uint16_t LIFECYCLE = 2;
+
+	static const size_t HEADER_SIZE = 12;
+
+	/** Replaces blob with a snapshot of model, created with id */
+	static void save(const PupilDynamicsModel & model, PupilModelId id, std::vector<char> & blob) {
+		blob.clear();
+		CheckpointWriter out(blob);
+		writeHeader(out, PUPIL_MODEL);
+		out.write((uint8_t) id);
+		model.saveState(out);
+		finish(blob);
+	}
+
+	/**
+	 * Restores a snapshot into model, created with id. Returns false,
+	 * leaving the model unchanged, if the blob is not a valid snapshot of a
+	 * model with that id.
+	 */
+	static bool restore(const std::vector<char> & blob, PupilDynamicsModel & model, PupilModelId id) {
+		CheckpointReader in = open(blob, PUPIL_MODEL);
+		uint8_t stateId;
+		if (!in.read(stateId) || stateId != (uint8_t) id) return false;
+		return model.restoreState(in);
+	}
+
+	/** New model restored from a snapshot, NULL if the blob is invalid */
+	static PupilDynamicsModel * restore(const std::vector<char> & blob) {
+		CheckpointReader in = open(blob, PUPIL_MODEL);
+		uint8_t stateId;
+		if (!in.read(stateId) || stateId >= ModelRegistry::PUPIL_MODELS) return NULL;
+
+		PupilDynamicsModel * model = ModelRegistry::create((PupilModelId) stateId);
+		if (!model->restoreState(in)) {
+			delete model;
+			return NULL;
+		}
+		return model;
+	}
+
+	static uint32_t magicNumber() {
+		uint32_t magic;
+		memcpy(&magic, MAGIC, sizeof(magic));
+		return magic;
+	}
+
+	static void writeHeader(CheckpointWriter & out, uint16_t kind) {
+		out.write(magicNumber());
+		out.write(VERSION);
+		out.write(kind);
+		out.write((uint32_t) 0);
+	}
+
+	/** Writes the size of the payload in the header */
+	static void finish(std::vector<char> & blob) {
+		uint32_t size = blob.size() - HEADER_SIZE;
+		memcpy(&blob[8], &size, sizeof(size));
+	}
+
+	/**
+	 * Reader over the payload of blob, already failed if the header is not
+	 * the one of a snapshot of this kind and version.
+	 */
+	static CheckpointReader open(const std::vector<char> & blob, uint16_t kind) {
+		CheckpointReader in(blob.data(), blob.size());
+		uint32_t magic, size;
+		uint16_t version, stateKind;
+		in.read(magic);
+		in.read(version);
+		in.read(stateKind);
+		in.read(size);
+
+		bool valid = in.ok() && magic == magicNumber() && version == VERSION
+		          && stateKind == kind && size == in.remaining();
+		return valid ? in : CheckpointReader(NULL, 0);
+	}
+};
+
+#endif /*MODELCHECKPOINT_H_*/
@@ -0,0 +1,236 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MODELINSTRUMENTATION_H_
+#define MODELINSTRUMENTATION_H_
+
+#include <chrono>
+#include <cmath>
+#include <ostream>
+
+/** Timed parts of a model step, see ModelInstrumentation::setTiming */
+enum ModelTimer {
+	STEP_TIMER,			// a whole pupilDiameterAt
+	RIGHT_SIDE_TIMER,	// the delayed flux and the right side it drives
+	SOLVER_TIMER,		// the solve for the new diameter or area
+	MODEL_TIMERS
+};
+
+/** The last step whose solver failed */
+class DivergenceRecord {
+public:
+	float time;			// of the step
+	float size;			// diameter or area kept from the previous step
+	float rightSide;	// that the solver could not reach
+};
+
+/**
+ * Counters of a pupil model: steps, solver iterations, divergences and
+ * solves stopped above the tolerance, sizes clamped by addPulse, delayed
+ * flux reads from the history and, for the envelope model, right sides
+ * reused or computed again. Timers of the parts of a step are optional.
+ *
+ * Counting costs a few increments per step. Timers read the clock, so
+ * they only run after setTiming(true). Compiled with
+ * PLR_NO_INSTRUMENTATION, every record method and timer is empty, except
+ * for the iterations of the last solve, which the trace reads.
+ */
+class ModelInstrumentation {
+public:
+	// solves of 0-1, 2, 3-4, 5-8, 9-16, 17-32, 33-64 and more iterations
+	static const int ITERATION_BUCKETS = 8;
+
+	long steps;
+	long solves;
+	long iterations;
+	int lastIterations;
+	int maxIterations;
+	long iterationHistogram[ITERATION_BUCKETS];
+	long divergences;
+	long unconverged;		// solves that stopped above the tolerance
+	DivergenceRecord lastDivergence;
+	long clamps;
+	long lookups;
+	long fluxReused;		// right sides reused: same last pulse and latency
+	long fluxLogarithms;	// right sides of a new flux, that needed a log
+
+	bool timing;
+	double timerSeconds[MODEL_TIMERS];
+	long timerCalls[MODEL_TIMERS];
+
+	ModelInstrumentation() : timing(false) { clear(); }
+
+	void clear() {
+		steps = 0;
+		solves = 0;
+		iterations = 0;
+		lastIterations = 0;
+		maxIterations = 0;
+		for (int b=0; b<ITERATION_BUCKETS; b++) iterationHistogram[b] = 0;
+		divergences = 0;
+		unconverged = 0;
+		lastDivergence = DivergenceRecord();
+		clamps = 0;
+		lookups = 0;
+		fluxReused = 0;
+		fluxLogarithms = 0;
+		for (int t=0; t<MODEL_TIMERS; t++) {
+			timerSeconds[t] = 0;
+			timerCalls[t] = 0;
+		}
+	}
+
+	/** Histogram bucket of a solve that took iterations */
+	static int bucket(int iterations) {
+		int b = 0;
+		while (b < ITERATION_BUCKETS - 1 && iterations > (1 << b)) b++;
+		return b;
+	}
+
+	void recordStep() {
+#ifndef PLR_NO_INSTRUMENTATION
+		steps++;
+#endif
+	}
+
+	void recordSolve(int solveIterations) {
+		lastIterations = solveIterations;
+#ifndef PLR_NO_INSTRUMENTATION
+		solves++;
+		iterations += solveIterations;
+		if (solveIterations > maxIterations) maxIterations = solveIterations;
+		iterationHistogram[bucket(solveIterations)]++;
+#endif
+	}
+
+	void recordUnconverged() {
+#ifndef PLR_NO_INSTRUMENTATION
+		unconverged++;
+#endif
+	}
+
+	void recordDivergence(float time, float size, float rightSide) {
+#ifndef PLR_NO_INSTRUMENTATION
+		divergences++;
+		lastDivergence.time = time;
+		lastDivergence.size = size;
+		lastDivergence.rightSide = rightSide;
+#endif
+	}
+
+	void recordClamp() {
+#ifndef PLR_NO_INSTRUMENTATION
+		clamps++;
+#endif
+	}
+
+	void recordLookup() {
+#ifndef PLR_NO_INSTRUMENTATION
+		lookups++;
+#endif
+	}
+
+	void recordFluxReuse() {
+#ifndef PLR_NO_INSTRUMENTATION
+		fluxReused++;
+#endif
+	}
+
+	void recordFluxLogarithm() {
+#ifndef PLR_NO_INSTRUMENTATION
+		fluxLogarithms++;
+#endif
+	}
+
+	double averageIterations() const {
+		return solves > 0 ? (double) iterations / solves : 0;
+	}
+
+	/** Times the parts of every step from now on, see ScopedModelTimer */
+	void setTiming(bool v) {
+		timing = v;
+	}
+
+	bool isTiming() const {
+		return timing;
+	}
+
+	/** The counters, and the timers that ran, as a JSON object */
+	void writeJson(std::ostream & out) const {
+		static const char * timerNames[MODEL_TIMERS] = { "step", "right_side", "solver" };
+
+		out << "{\"steps\": " << steps << ", \"solves\": " << solves << ", \"max_iterations\": " << maxIterations
+		    << ", \"iterations\": [";
+		for (int b=0; b<ITERATION_BUCKETS; b++) {
+			out << (b == 0 ? "" : ", ") << iterationHistogram[b];
+		}
+		out << "], \"divergences\": " << divergences << ", \"unconverged\": " << unconverged;
+		if (divergences > 0) {
+			out << ", \"last_divergence\": {\"time\": ";
+			writeNumber(out, lastDivergence.time);
+			out << ", \"size\": ";
+			writeNumber(out, lastDivergence.size);
+			out << ", \"right_side\": ";
+			writeNumber(out, lastDivergence.rightSide);
+			out << "}";
+		}
+		out << ", \"clamps\": " << clamps << ", \"lookups\": " << lookups
+		    << ", \"flux_reused\": " << fluxReused << ", \"flux_logarithms\": " << fluxLogarithms;
+		for (int t=0; t<MODEL_TIMERS; t++) {
+			if (timerCalls[t] == 0) continue;
+			out << ", \"" << timerNames[t] << "_ns\": ";
+			writeNumber(out, timerSeconds[t] * 1.0e9 / timerCalls[t]);
+		}
+		out << "}";
+	}
+
+private:
+	/** JSON has no infinity or NaN: writes null for them */
+	static void writeNumber(std::ostream & out, double value) {
+		if (std::isfinite(value)) out << value; else out << "null";
+	}
+};
+
+/**
+ * Adds the time until it goes out of scope to a timer of instrumentation,
+ * when its timing is on.
+ */
+class ScopedModelTimer {
+#ifndef PLR_NO_INSTRUMENTATION
+	ModelInstrumentation & instrumentation;
+	ModelTimer timer;
+	bool running;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	ScopedModelTimer(ModelInstrumentation & _instrumentation, ModelTimer _timer) :
+		instrumentation(_instrumentation), timer(_timer), running(_instrumentation.timing) {
+		if (running) start = std::chrono::steady_clock::now();
+	}
+
+	~ScopedModelTimer() {
+		if (!running) return;
+		instrumentation.timerSeconds[timer] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		instrumentation.timerCalls[timer]++;
+	}
+#else
+public:
+	ScopedModelTimer(ModelInstrumentation &, ModelTimer) {}
+#endif
+};
+
+#endif /*MODELINSTRUMENTATION_H_*/
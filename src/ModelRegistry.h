@@ -0,0 +1,171 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MODELREGISTRY_H_
+#define MODELREGISTRY_H_
+
+#include <cctype>
+
+enum class PupilModelId {
+	DEGROOT_AND_GEBHARD,
+	REEVES,
+	MOON_AND_SPENCER,
+	PAMPLONA_AND_OLIVEIRA,
+	PAMPLONA_AND_OLIVEIRA_WITH_ENVELOPE,
+	POKORNY_AND_SMITH,
+	LONGTIN_AND_MILTON
+};
+
+enum class LatencyModelId {
+	ELLIS,
+	LINK_AND_STARK
+};
+
+/** Unit of the intensity given to pupilDiameterAt */
+enum class IntensityUnit {
+	BLONDEL,
+	LUMENS_PER_SQUARE_MM
+};
+
+class PupilModelInfo {
+public:
+	const char * name;		// as returned by getName()
+	IntensityUnit unit;
+	bool stateful;			// delay model that needs a history of pulses
+	PupilModelId next;		// following model in PupilLifecycle::nextPupilModel
+};
+
+class LatencyModelInfo {
+public:
+	const char * name;
+	LatencyModelId next;
+};
+
+/**
+ * Ids, metadata and factories of all models, so the lifecycle switches
+ * models without comparing their names.
+ */
+class ModelRegistry {
+public:
+	static constexpr int PUPIL_MODELS = 7;
+	static constexpr int LATENCY_MODELS = 2;
+
+	static constexpr PupilModelInfo pupilModels[PUPIL_MODELS] = {
+		{ "Degroot And Gebhard",     IntensityUnit::BLONDEL,              false, PupilModelId::REEVES },
+		{ "Reeves",                  IntensityUnit::BLONDEL,              false, PupilModelId::MOON_AND_SPENCER },
+		{ "Moon And Spencer",        IntensityUnit::BLONDEL,              false, PupilModelId::PAMPLONA_AND_OLIVEIRA },
+		{ "Our Model",               IntensityUnit::LUMENS_PER_SQUARE_MM, true,  PupilModelId::PAMPLONA_AND_OLIVEIRA_WITH_ENVELOPE },
+		{ "Our Model With Envelope", IntensityUnit::LUMENS_PER_SQUARE_MM, true,  PupilModelId::POKORNY_AND_SMITH },
+		{ "Pokorny And Smith",       IntensityUnit::BLONDEL,              false, PupilModelId::LONGTIN_AND_MILTON },
+		{ "Longtin And Milton",      IntensityUnit::LUMENS_PER_SQUARE_MM, true,  PupilModelId::DEGROOT_AND_GEBHARD }
+	};
+
+	static constexpr LatencyModelInfo latencyModels[LATENCY_MODELS] = {
+		{ "Ellis",          LatencyModelId::LINK_AND_STARK },
+		{ "Link And Stark", LatencyModelId::ELLIS }
+	};
+
+	static constexpr const PupilModelInfo & info(PupilModelId id) {
+		return pupilModels[(int) id];
+	}
+
+	static constexpr const LatencyModelInfo & info(LatencyModelId id) {
+		return latencyModels[(int) id];
+	}
+
+	/**
+	 * Model named name or numbered by its id. Names ignore case, spaces and
+	 * punctuation: "moon-and-spencer" finds "Moon And Spencer".
+	 */
+	static bool find(const char * name, PupilModelId & id) {
+		for (int i=0; i<PUPIL_MODELS; i++) {
+			if (matches(name, i, pupilModels[i].name)) {
+				id = (PupilModelId) i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static bool find(const char * name, LatencyModelId & id) {
+		for (int i=0; i<LATENCY_MODELS; i++) {
+			if (matches(name, i, latencyModels[i].name)) {
+				id = (LatencyModelId) i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static PupilDynamicsModel * create(PupilModelId id) {
+		switch (id) {
+			case PupilModelId::DEGROOT_AND_GEBHARD: return new DegrootAndGebhardModel();
+			case PupilModelId::REEVES: return new ReevesModel();
+			case PupilModelId::MOON_AND_SPENCER: return new MoonAndSpencerModel();
+			case PupilModelId::PAMPLONA_AND_OLIVEIRA: return new PamplonaAndOliveiraModel();
+			case PupilModelId::PAMPLONA_AND_OLIVEIRA_WITH_ENVELOPE: {
+				PamplonaAndOliveiraWithEnvelopeModel * model = new PamplonaAndOliveiraWithEnvelopeModel();
+				model->setWithEnvelope(true);
+				return model;
+			}
+			case PupilModelId::POKORNY_AND_SMITH: return new PokornyAndSmithModel();
+			case PupilModelId::LONGTIN_AND_MILTON: return new LongtinAndMiltonModel();
+		}
+		return NULL;
+	}
+
+	static LatencyModel * create(LatencyModelId id) {
+		switch (id) {
+			case LatencyModelId::ELLIS: return new EllisModel();
+			case LatencyModelId::LINK_AND_STARK: return new LinkAndStarkModel(0.4);
+		}
+		return NULL;
+	}
+
+private:
+	static bool matches(const char * name, int id, const char * modelName) {
+		if (isdigit(name[0])) return atoi(name) == id;
+
+		while (true) {
+			while (*name && !isalnum(*name)) name++;
+			while (*modelName && !isalnum(*modelName)) modelName++;
+			if (!*name || !*modelName) return !*name && !*modelName;
+			if (tolower(*name) != tolower(*modelName)) return false;
+			name++;
+			modelName++;
+		}
+	}
+};
+
+/**
+ * Id of a model class, for the code that knows the model at compile time.
+ */
+template <class Model>
+class ModelTraits;
+
+template <> class ModelTraits<DegrootAndGebhardModel> { public: static constexpr PupilModelId id = PupilModelId::DEGROOT_AND_GEBHARD; };
+template <> class ModelTraits<ReevesModel> { public: static constexpr PupilModelId id = PupilModelId::REEVES; };
+template <> class ModelTraits<MoonAndSpencerModel> { public: static constexpr PupilModelId id = PupilModelId::MOON_AND_SPENCER; };
+template <> class ModelTraits<PamplonaAndOliveiraModel> { public: static constexpr PupilModelId id = PupilModelId::PAMPLONA_AND_OLIVEIRA; };
+template <> class ModelTraits<PamplonaAndOliveiraWithEnvelopeModel> { public: static constexpr PupilModelId id = PupilModelId::PAMPLONA_AND_OLIVEIRA_WITH_ENVELOPE; };
+template <> class ModelTraits<PokornyAndSmithModel> { public: static constexpr PupilModelId id = PupilModelId::POKORNY_AND_SMITH; };
+template <> class ModelTraits<LongtinAndMiltonModel> { public: static constexpr PupilModelId id = PupilModelId::LONGTIN_AND_MILTON; };
+
+template <> class ModelTraits<EllisModel> { public: static constexpr LatencyModelId id = LatencyModelId::ELLIS; };
+template <> class ModelTraits<LinkAndStarkModel> { public: static constexpr LatencyModelId id = LatencyModelId::LINK_AND_STARK; };
+
+#endif /*MODELREGISTRY_H_*/
@@ -39,6 +39,23 @@ public:
 	virtual float pupilDiameterAt(float lightIntensity) {
 		return pupilDiameterWithBlondel(lightIntensity);
 	}
+
+	/**
+	 * Intensities in Blondels
+	 */
+	virtual void pupilDiameterAt(const float * intensities, float * diameters, size_t n) {
+		size_t i = 0;
+#ifdef PLR_SIMD
+		for (; i + FLOAT_PACK_WIDTH <= n; i += FLOAT_PACK_WIDTH) {
+			FloatPack intensity = FloatPack::load(intensities + i);
+			FloatPack diameter = FloatPack(4.9f) - FloatPack(3.0f)*tanh(FloatPack(0.4f)*(log10(intensity)-FloatPack(0.5f)));
+			diameter.store(diameters + i);
+		}
+#endif
+		for (; i < n; i++) {
+			diameters[i] = MoonAndSpencerModel::pupilDiameterWithBlondel(intensities[i]);
+		}
+	}
 		
 	/**
 	 * Intensity in Blondel 
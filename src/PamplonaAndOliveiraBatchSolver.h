@@ -0,0 +1,158 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PAMPLONAANDOLIVEIRABATCHSOLVER_H_
+#define PAMPLONAANDOLIVEIRABATCHSOLVER_H_
+
+/**
+ * Solves Equation 16 of PamplonaAndOliveiraModel for many pupils at once.
+ *
+ * Every lane of a FloatPack runs the step-halving search of
+ * PamplonaAndOliveiraModel::solveDiameter for one pupil. Lanes that find
+ * their diameter are masked out while the others keep iterating, and the
+ * pack stops as soon as all lanes are done. Without SIMD support the scalar
+ * solver is called pupil by pupil.
+ *
+ * The vector search runs in single precision with the approximated log of
+ * SimdMath.h, so it may stop at a different point of the same 0.001 window
+ * around the right side. Diameters match the scalar solver within 2e-3 mm.
+ */
+class PamplonaAndOliveiraBatchSolver {
+
+#ifdef PLR_SIMD
+	static FloatPack m(FloatPack diameter) {
+		return arcTanH((diameter - FloatPack(4.9f)) / FloatPack(3.0f));
+	}
+
+	static FloatPack evaluateLeftSide(FloatPack prevDiameter, FloatPack prevM, FloatPack dT, FloatPack dD) {
+		FloatPack zero(0.0f);
+		FloatPack mD = m(prevDiameter + dD);
+
+		// Dilation Velocity
+		dT = select(zero < dD, dT / FloatPack(3.0f), dT);
+
+		FloatPack flat = (abs(dD) <= FloatPack(0.0001f)) | (abs(dT) <= FloatPack(0.0001f));
+		FloatPack stationary = FloatPack(2.3025f) * mD;
+
+		return select(flat, stationary, (mD - prevM) / dT + stationary);
+	}
+
+	/** Solves one pack of pupils. Returns the number of lanes that diverged. */
+	static int solvePack(FloatPack prevDiameter, FloatPack dT, FloatPack rightSide, FloatPack & diameter) {
+		FloatPack zero(0.0f);
+		FloatPack prevM = m(prevDiameter);
+
+		FloatPack dD = zero;
+		FloatPack pass(10.0f);
+		FloatPack leftSideAnt = zero;
+		FloatPack operation(1.0f);
+
+		FloatPack allLanes = zero <= zero;
+		FloatPack active = allLanes;
+
+		// diverged lanes keep the previous diameter
+		diameter = prevDiameter;
+
+		for (int i=0; i<100 && any(active); i++) {
+			FloatPack leftSide = evaluateLeftSide(prevDiameter, prevM, dT, dD);
+
+			// lanes that found the right value
+			FloatPack found = active & (abs(leftSide - rightSide) <= FloatPack(0.001f));
+			diameter = select(found, prevDiameter + dD, diameter);
+			active = andNot(found, active);
+
+			FloatPack goingUp = (leftSide - leftSideAnt > FloatPack(0.001f)) & (rightSide > leftSide);
+			FloatPack goingDown = (leftSide - leftSideAnt < FloatPack(-0.001f)) & (rightSide < leftSide);
+
+			// invert the search
+			FloatPack invert = andNot(goingUp | goingDown, allLanes);
+			operation = select(invert, zero - operation, operation);
+
+			if (i>0) {
+				// decrease the step size
+				FloatPack shrink = invert & (pass > FloatPack(0.0000001f));
+				dD = select(shrink, dD + operation * pass, dD);
+
+				// if the new value is equal to the previous one, can be a solution
+				FloatPack flat = shrink & (abs(leftSide - leftSideAnt) <= FloatPack(0.00001f));
+				FloatPack possible = flat & (((operation < zero) & (leftSide > rightSide))
+				                          |  ((operation > zero) & (leftSide < rightSide)));
+
+				FloatPack stop = active & possible;
+				diameter = select(stop, prevDiameter + dD, diameter);
+				active = andNot(stop, active);
+
+				// go back one step
+				dD = select(andNot(possible, flat), dD + operation * pass, dD);
+				pass = select(shrink, pass * FloatPack(0.5f), pass);
+			}
+
+			dD = dD + operation * pass;
+			leftSideAnt = leftSide;
+		}
+
+		return countLanes(active);
+	}
+#endif
+
+public:
+	/**
+	 * Solves Equation 16 for n pupils after the same step dT (already
+	 * normalized as in PamplonaAndOliveiraModel::normalizedDt).
+	 * Returns the number of pupils that diverged and kept the previous diameter.
+	 */
+	static int solveDiameters(const float * prevDiameters, float dT, const float * rightSides, float * diameters, int n) {
+		int diverged = 0;
+		int p = 0;
+
+#ifdef PLR_SIMD
+		FloatPack dTs(dT);
+		for (; p + FLOAT_PACK_WIDTH <= n; p += FLOAT_PACK_WIDTH) {
+			FloatPack diameter;
+			diverged += solvePack(FloatPack::load(prevDiameters + p), dTs, FloatPack::load(rightSides + p), diameter);
+			diameter.store(diameters + p);
+		}
+
+		if (p < n) {
+			// pad the tail with pupils already at rest
+			float prev[FLOAT_PACK_WIDTH];
+			float right[FLOAT_PACK_WIDTH];
+			float result[FLOAT_PACK_WIDTH];
+			for (int i=0; i<FLOAT_PACK_WIDTH; i++) {
+				prev[i] = p + i < n ? prevDiameters[p + i] : 4.9f;
+				right[i] = p + i < n ? rightSides[p + i] : 0.0f;
+			}
+
+			FloatPack diameter;
+			diverged += solvePack(FloatPack::load(prev), dTs, FloatPack::load(right), diameter);
+			diameter.store(result);
+
+			for (int i=0; p + i < n; i++) {
+				diameters[p + i] = result[i];
+			}
+		}
+#else
+		for (; p < n; p++) {
+			diameters[p] = PamplonaAndOliveiraModel::solveDiameter(prevDiameters[p], dT, rightSides[p]);
+		}
+#endif
+
+		return diverged;
+	}
+};
+
+#endif /*PAMPLONAANDOLIVEIRABATCHSOLVER_H_*/
@@ -18,6 +18,15 @@
 #ifndef PamplonaAndOliveiraMODEL_H_
 #define PamplonaAndOliveiraMODEL_H_
 
+/**
+ * How PamplonaAndOliveiraModel advances Equation 16.
+ */
+enum IntegratorType {
+	IMPLICIT_INTEGRATOR,	// solves the implicit step for dD (see SolverType)
+	RK4_INTEGRATOR,			// classic Runge-Kutta on M(D) with the delayed flux at each stage
+	EXPONENTIAL_INTEGRATOR	// exact step of the linear 2.3025*M term, flux taken at mid step
+};
+
 /**
  * Pamplona's Model for Pupil Light Reflex
  *
@@ -30,13 +39,75 @@ class PamplonaAndOliveiraModel : public PupilDynamicsModel {
 	// x = time (milliseconds) , 
 	// y = intensity (lumens), 
 	// z = pupil diameter (mm).
-	HistoryFifo<Vector3f, 1000> history;
+	HistoryFifo<PupilSample, 1000> history;
+
+	// pulses dropped by history, for latencies longer than it spans
+	HistoryArchive archive;
 	
 	float dt;
 	double minimumThreshold;
+
+	SolverType solver;
+	IntegratorType integrator;
+	bool lookupTables;
+
+	// delayed intensity and area, newest entry at or before the time
+	DelayLookup<1000> delay;
 	
 public:
-	PamplonaAndOliveiraModel() : PupilDynamicsModel("Our Model") {		
+	/**
+	 * Equation 16 as a function of dD, for RootFinder.
+	 */
+	class Equation16 {
+	public:
+		double prevDiameter;
+		double prevM;
+		double dT;
+		double rightSide;
+		// below this dT the derivative term is dropped
+		double stationaryDt;
+		// m(D) from LookupTables
+		bool lookupTables;
+
+		Equation16(double _prevDiameter, double _dT, double _rightSide, double _stationaryDt, bool _lookupTables = false) {
+			// m(D) is only defined for diameters in (1.9, 7.9)
+			prevDiameter = std::min(std::max(_prevDiameter, 1.9001), 7.8999);
+			lookupTables = _lookupTables;
+			prevM = m(prevDiameter, lookupTables);
+			dT = _dT;
+			rightSide = _rightSide;
+			stationaryDt = _stationaryDt;
+		}
+
+		void evaluate(double dD, double & value, double & derivative) {
+			double diameter = prevDiameter + dD;
+			double x = (diameter - 4.9) / 3;
+			double dMdD = (1.0/3.0) / (1 - x*x);
+			double mD;
+
+			if (lookupTables && LookupTables::mTable().contains(diameter))
+				mD = LookupTables::mTable().at(diameter);
+			else
+				mD = 0.5 * (log(1+x) - log(1-x));
+
+			if (fabs(dT) <= stationaryDt) {
+				value = 2.3025*mD - rightSide;
+				derivative = 2.3025*dMdD;
+				return;
+			}
+
+			// Dilation Velocity
+			double dTs = dD > 0 ? dT / 3.0 : dT;
+
+			value = (mD - prevM)/dTs + 2.3025*mD - rightSide;
+			derivative = dMdD * (1/dTs + 2.3025);
+		}
+
+		double lowestDD() const { return 1.9 - prevDiameter; }
+		double highestDD() const { return 7.9 - prevDiameter; }
+	};
+
+	PamplonaAndOliveiraModel() : PupilDynamicsModel("Our Model"), delay(true, 0.1) {		
 		init();
 	}
 	virtual ~PamplonaAndOliveiraModel() {}
@@ -44,16 +115,19 @@ public:
 	void init() {
 		dt = 0.3f;
 		minimumThreshold = evalPhiBar(); //4.8118f * pow(10, -10.0f);
+		solver = STEP_HALVING_SOLVER;
+		integrator = IMPLICIT_INTEGRATOR;
+		lookupTables = false;
 	}
 	
-	float evalPhiBar() {
-		MoonAndSpencerModel *  moon = new MoonAndSpencerModel();
+	static float evalPhiBar() {
+		MoonAndSpencerModel moon;
 		// Lower intensity
 		float phiBarIntensityBlondels = powf(10, -5);
 		// To Lumens per Square MM
 		float phiBarIntensityLumensMM = Conversion::blondelToLumensSquareMillimeter(phiBarIntensityBlondels);
 		// Get pupil diameter
-		float phiBarDiameter = moon->pupilDiameterWithBlondel(phiBarIntensityBlondels);
+		float phiBarDiameter = moon.pupilDiameterWithBlondel(phiBarIntensityBlondels);
 		// find phiBar = Area * lumens/MM2
 		float phiBar = Conversion::diameterToArea(phiBarDiameter) * phiBarIntensityLumensMM;
 		return phiBar;
@@ -61,9 +135,13 @@ public:
 	
 	virtual bool isInLumens() { return true; }
 	
-	HistoryFifo<Vector3f, 1000> getHistory() {
+	const HistoryFifo<PupilSample, 1000> & getHistory() const {
 		return history;
 	}
+
+	const HistoryArchive & getArchive() const {
+		return archive;
+	}
 	
 	void setDt(float _dt) {
 		dt = _dt;
@@ -72,12 +150,134 @@ public:
 	float getDt() {
 		return dt;
 	}	
-	
+
+	void setSolver(SolverType _solver) {
+		solver = _solver;
+	}
+
+	SolverType getSolver() {
+		return solver;
+	}
+
+	void setIntegrator(IntegratorType _integrator) {
+		integrator = _integrator;
+	}
+
+	IntegratorType getIntegrator() {
+		return integrator;
+	}
+
+	/** Evaluates m(D) with the interpolated tables of LookupTables */
+	void setLookupTables(bool v) {
+		lookupTables = v;
+	}
+
+	bool usesLookupTables() {
+		return lookupTables;
+	}
+
+	/** How the delayed flux is read between history entries, see DelayLookup */
+	void setDelayInterpolation(DelayInterpolation v) {
+		delay.setInterpolation(v);
+	}
+
+	DelayInterpolation getDelayInterpolation() {
+		return delay.getInterpolation();
+	}
+
+	/** dt, phi bar, solver, integrator, tables, interpolation, archive and history */
+	void saveState(CheckpointWriter & out) const {
+		out.write(dt);
+		out.write(minimumThreshold);
+		out.write((int32_t) solver);
+		out.write((int32_t) integrator);
+		out.write((uint8_t) lookupTables);
+		out.write((uint8_t) delay.getInterpolation());
+		archive.saveState(out);
+		out.writeHistory(history);
+	}
+
+	bool restoreState(CheckpointReader & in) {
+		float stateDt;
+		double stateThreshold;
+		int32_t stateSolver, stateIntegrator;
+		uint8_t stateTables, stateInterpolation;
+
+		in.read(stateDt);
+		in.read(stateThreshold);
+		in.read(stateSolver);
+		in.read(stateIntegrator);
+		in.read(stateTables);
+		in.read(stateInterpolation);
+		if (!in.ok()) return false;
+		if (!CheckpointReader::isPositive(stateDt) || !CheckpointReader::isPositive(stateThreshold)
+		    || !CheckpointReader::isEnum(stateSolver, NEWTON_SOLVER)
+		    || !CheckpointReader::isEnum(stateIntegrator, EXPONENTIAL_INTEGRATOR)
+		    || !CheckpointReader::isEnum(stateInterpolation, HERMITE_DELAY)) return false;
+
+		HistoryArchive stateArchive;
+		HistoryFifo<PupilSample, 1000> stateHistory;
+		if (!stateArchive.restoreState(in) || !in.readHistory(stateHistory) || in.remaining() != 0) return false;
+
+		dt = stateDt;
+		minimumThreshold = stateThreshold;
+		solver = (SolverType) stateSolver;
+		integrator = (IntegratorType) stateIntegrator;
+		lookupTables = stateTables != 0;
+		delay.setInterpolation((DelayInterpolation) stateInterpolation);
+		archive = stateArchive;
+		history = stateHistory;
+		return true;
+	}
+
+	/**
+	 * Diameter (mm) at which the model rests under blondels, for a phi bar
+	 * of flux. LookupTables::pamplonaSteadyTable() is exact for the default
+	 * phi bar; two Newton steps on the same equation correct the rest.
+	 */
+	static float steadyDiameter(float blondels, double phiBar) {
+		double diameter = LookupTables::pamplonaSteadyTable().clampedAt(log10(blondels));
+		double intensity = Conversion::blondelToLumensSquareMillimeter(blondels);
+
+		for (int i=0; i<2; i++) {
+			double x = (diameter - 4.9) / 3;
+			double f = 2.3025 * m(diameter) - 5.2 + 0.45 * log(intensity * Conversion::diameterToArea(diameter) / phiBar);
+			double derivative = 2.3025 * (1.0/3.0) / (1 - x*x) + 0.9 / diameter;
+			diameter = std::min(std::max(diameter - f / derivative, 1.9001), 7.8999);
+		}
+		return diameter;
+	}
+
+	/** 10 s of history at the steady diameter, see steadyDiameter */
+	void setSteadyState(float time, float blondels) {
+		float intensity = Conversion::blondelToLumensSquareMillimeter(blondels);
+		float area = Conversion::diameterToArea(steadyDiameter(blondels, minimumThreshold));
+
+		history.clear();
+		archive.clear();
+		for (int i=100; i>0; i--) {
+			addPulse(time - 100*i, intensity, area);
+		}
+	}
+
+	void removeLastPulse() {
+		if (history.size() > 1) history.removeLast();
+	}
+
+	void reserveHistory(int pulses) {
+		while (history.size() > 1 && history.size() > history.capacity() - pulses) {
+			archive.add(history.first());
+			history.removeFirst();
+		}
+	}
+
 	void addPulse(float mSeconds, float intensity, float area) {
+		if (area < 2.7000f || area > 48.890f) instrumentation.recordClamp();
 		if (area < 2.7000f) area = 2.7001;
 		if (area > 48.890f) area = 48.889;
 		
-		history.add(Vector3f(mSeconds, intensity, area));
+		if (history.size() == history.capacity()) archive.add(history.first());
+		history.add(PupilSample(mSeconds, intensity, area));
 	}
 	
 	/**
@@ -91,37 +291,8 @@ public:
 	}
 	
 	float retinalFlux(float latencyInMilliseconds) {
-		int size = history.history.size()-1;
-		
-		double time = history.history[size].x();
-		double fromTime = time - latencyInMilliseconds;
-		
-		for (int i=size; i>=0; i--) {
-			if (!(fromTime < history.history[i].x())) {
-				Vector3f iAtual = history.history[i];
-				Vector3f iAnterior = history.history[i+1];
-
-				if (i == size) {
-					iAnterior = iAtual;
-				}
-
-				float deltaTime = iAnterior.x() - iAtual.x();
-				float resto = fromTime - iAtual.x();
-
-				float percent = 0.1;
-
-				if (fabs(deltaTime) > 0.01)
-					percent = resto / deltaTime;
-				
-				// linear filter
-				float intensity = iAtual.y() + (iAnterior.y() - iAtual.y()) * percent;
-				float area 		= iAtual.z() + (iAnterior.z() - iAtual.z()) * percent;
-			
-				return retinalFlux(intensity, area);
-			}
-		}
-
-		return 0;
+		instrumentation.recordLookup();
+		return delay.flux(history, history.last().time - (double) latencyInMilliseconds, &archive);
 	}
 	
 	float logarithmOfRetinalFluxRate(float latency) {
@@ -132,40 +303,176 @@ public:
 	float muscleActivity(float latency) {
 		return 5.2 - 0.45 * logarithmOfRetinalFluxRate(latency); 
 	}
+
+	/** Muscle activity for a retinal flux already taken from the history */
+	static float muscleActivityForFlux(float flux, double minimumThreshold) {
+		float logarithmOfRate = log(flux/minimumThreshold);
+		return 5.2 - 0.45 * logarithmOfRate;
+	}
 		
-	float arcTanH(float x) {
+	static float arcTanH(float x) {
 		return 0.5f * (log(1+x) - log(1-x));
 	}
 
-	float m(float diameter) {
+	static float m(float diameter) {
 		return arcTanH((diameter - 4.9) / 3);
 	}
 
+	static float m(float diameter, bool lookupTables) {
+		if (lookupTables && LookupTables::mTable().contains(diameter))
+			return LookupTables::mTable().at(diameter);
+		return m(diameter);
+	}
+
+	/**
+	 * Time elapsed since the last pulse, in the units of Equation 16.
+	 */
+	float normalizedDt(float time) {
+		return (time - history.last().time) / 500.0f;
+	}
+
 	float evaluateLeftSide(float time, float dD) {
-		float dT = (time - (history.history.end()-1)->x()) / 500.0f;
-		float prevDiammeter = Conversion::areaToDiameter(history.history[history.history.size()-1].z());
-		
+		return evaluateLeftSide(Conversion::areaToDiameter(history.last().area), normalizedDt(time), dD, lookupTables);
+	}
+
+	static float evaluateLeftSide(float prevDiammeter, float dT, float dD, bool lookupTables = false) {
 		float diameter = prevDiammeter + dD;
-		float prevM = m(prevDiammeter);
-		float dM = m(diameter) - prevM;
+		float prevM = m(prevDiammeter, lookupTables);
+		float mD = m(diameter, lookupTables);
+		float dM = mD - prevM;
 
 		if (dD > 0) {
 			dT /= 3.0f;
 		}
 			
 		if (equals(dD, 0.000f,0.0001f) || equals(dT, 0.000f,0.0001f))
-			return 2.3025*m(diameter);
+			return 2.3025*mD;
 		else
-			return dM/dT + 2.3025*m(diameter);
+			return dM/dT + 2.3025*mD;
 	}
 	
 	/**
 	 * 
 	 */ 
 	float evaluateDiameter(float latency, float time) {
+		if (integrator != IMPLICIT_INTEGRATOR)
+			return integrateDiameter(latency, time);
+
 		// Compute the right side of the equation. This will not change.
-		float rightSide = muscleActivity(latency);
+		float rightSide;
+		{
+			ScopedModelTimer timer(instrumentation, RIGHT_SIDE_TIMER);
+			rightSide = muscleActivity(latency);
+		}
+		float prevDiameter = Conversion::areaToDiameter(history.last().area);
+
+		int iterations;
+		RootStatus status;
+		float diameter;
+		{
+			ScopedModelTimer timer(instrumentation, SOLVER_TIMER);
+			diameter = solveDiameter(solver, prevDiameter, normalizedDt(time), rightSide, iterations, status, lookupTables);
+		}
+
+		instrumentation.recordSolve(iterations);
+		if (status == ROOT_NOT_CONVERGED) instrumentation.recordUnconverged();
+		if (status == ROOT_FAILED) instrumentation.recordDivergence(time, prevDiameter, rightSide);
+		return diameter;
+	}
+
+	/**
+	 * Rate of M(D) per unit of normalized time. Equation 16 gives
+	 * dM/dT = R - 2.3025*M, three times slower when the pupil dilates.
+	 */
+	static double rateOfM(double M, double rightSide) {
+		double rate = rightSide - 2.3025*M;
+		return rate > 0 ? rate / 3.0 : rate;
+	}
+
+	/**
+	 * Advances Equation 16 explicitly, without solving for dD.
+	 */
+	float integrateDiameter(float latency, float time) {
+		float prevDiameter = std::min(std::max(Conversion::areaToDiameter(history.last().area), 1.9001f), 7.8999f);
+		float stepInMilliseconds = time - history.last().time;
+		double h = normalizedDt(time);
+		double M = m(prevDiameter, lookupTables);
+
+		// forcing at the middle and at the end of the step, still in the past while the step is shorter than the latency
+		double rightSideAtHalf = muscleActivity(std::max(latency - stepInMilliseconds / 2, 0.0f));
+
+		if (integrator == EXPONENTIAL_INTEGRATOR) {
+			// the forcing is held constant, so the linear term integrates exactly
+			double steadyM = rightSideAtHalf / 2.3025;
+			double k = steadyM > M ? 2.3025 / 3.0 : 2.3025;
+			M = steadyM + (M - steadyM) * exp(-k * h);
+		} else {
+			double rightSideAtStart = muscleActivity(latency);
+			double rightSideAtEnd = muscleActivity(std::max(latency - stepInMilliseconds, 0.0f));
+
+			double k1 = rateOfM(M, rightSideAtStart);
+			double k2 = rateOfM(M + h/2 * k1, rightSideAtHalf);
+			double k3 = rateOfM(M + h/2 * k2, rightSideAtHalf);
+			double k4 = rateOfM(M + h * k3, rightSideAtEnd);
+			M = M + h/6 * (k1 + 2*k2 + 2*k3 + k4);
+		}
+
+		instrumentation.recordSolve(0);
+		return 4.9 + 3 * tanh(M);
+	}
+
+	static float solveDiameter(SolverType solver, float prevDiameter, float dT, float rightSide, int & iterations, bool & diverged, bool lookupTables = false) {
+		RootStatus status;
+		float diameter = solveDiameter(solver, prevDiameter, dT, rightSide, iterations, status, lookupTables);
+		diverged = status == ROOT_FAILED;
+		return diameter;
+	}
+
+	/** The step halving search gives ROOT_FOUND or ROOT_FAILED only */
+	static float solveDiameter(SolverType solver, float prevDiameter, float dT, float rightSide, int & iterations, RootStatus & status, bool lookupTables = false) {
+		if (solver == NEWTON_SOLVER)
+			return solveDiameterWithNewton(prevDiameter, dT, rightSide, iterations, status, 0.0001, lookupTables);
+
+		bool diverged;
+		float diameter = solveDiameter(prevDiameter, dT, rightSide, iterations, diverged, lookupTables);
+		status = diverged ? ROOT_FAILED : ROOT_FOUND;
+		return diameter;
+	}
+
+	static float solveDiameterWithNewton(float prevDiameter, float dT, float rightSide, int & iterations, bool & diverged, double stationaryDt = 0.0001, bool lookupTables = false) {
+		RootStatus status;
+		float diameter = solveDiameterWithNewton(prevDiameter, dT, rightSide, iterations, status, stationaryDt, lookupTables);
+		diverged = status == ROOT_FAILED;
+		return diameter;
+	}
+
+	/**
+	 * Solves Equation 16 after a step of dT starting from prevDiameter with
+	 * the safeguarded Newton of RootFinder.
+	 */
+	static float solveDiameterWithNewton(float prevDiameter, float dT, float rightSide, int & iterations, RootStatus & status, double stationaryDt = 0.0001, bool lookupTables = false) {
+		Equation16 equation(prevDiameter, dT, rightSide, stationaryDt, lookupTables);
+
+		double dD;
+		status = RootFinder::solve(equation, equation.lowestDD(), equation.highestDD(), true, 0.0, 0.001, dD, iterations);
+		if (status == ROOT_FAILED) return prevDiameter;
+
+		return equation.prevDiameter + dD;
+	}
+
+	static float solveDiameter(float prevDiameter, float dT, float rightSide) {
+		int iterations;
+		bool diverged;
+		return solveDiameter(prevDiameter, dT, rightSide, iterations, diverged);
+	}
+
+	/**
+	 * Searches the diameter that satisfies Equation 16 after a step of dT
+	 * starting from prevDiameter.
+	 */
+	static float solveDiameter(float prevDiameter, float dT, float rightSide, int & iterations, bool & diverged, bool lookupTables = false) {
 		float leftSide;
+		diverged = false;
 		
 		double dD = 0;
 		float pass = 10.0f;
@@ -173,11 +480,11 @@ public:
 		float operation = 1;
 		
 		for (int i=0; i<100; i++) {
-			leftSide = evaluateLeftSide(time, dD);
+			leftSide = evaluateLeftSide(prevDiameter, dT, dD, lookupTables);
+			iterations = i+1;
 			
 			// If it found the right value, return.
 			if (equals(leftSide, rightSide, 0.001)) {
-				float prevDiameter = Conversion::areaToDiameter((history.history.end()-1)->z());
 				return prevDiameter+dD;
 			}
 			
@@ -199,7 +506,6 @@ public:
 						// check if a solution is possible
 						if ((operation < 0 && leftSide > rightSide)
 						||  (operation > 0 && leftSide < rightSide)) {
-							float prevDiameter = Conversion::areaToDiameter((history.history.end()-1)->z());
 							return prevDiameter+dD;
 						}
 						
@@ -218,19 +524,19 @@ public:
 			leftSideAnt = leftSide;
 		}
 		
-		std::cout << "The Equation Diverged: " << dD << " " << pass << " "<< leftSide << " "<< rightSide << " " << std::endl;
-		
 		// If it fails, return the last pupil diameter.
-		float prevDiameter = Conversion::areaToDiameter((history.history.end()-1)->z());
+		// The models count the divergence, see ModelInstrumentation.
+		diverged = true;
 		return prevDiameter;
 	}
 	
 	float pupilDiameterAt(float intensity, float latency, float time) {
+		ScopedModelTimer timer(instrumentation, STEP_TIMER);
+		instrumentation.recordStep();
 		float diameter = evaluateDiameter(latency, time);
 		
-		//std::cout << intensity << " " << diameter << std::endl;
-		
 		addPulse(time,intensity, Conversion::diameterToArea(diameter));
+		trace(time, intensity, history.last().area, diameter, latency, instrumentation.lastIterations);
 		return diameter;
 	}
 
@@ -18,15 +18,6 @@
 #ifndef PamplonaAndOliveiraWithEnvelopeMODEL_H_
 #define PamplonaAndOliveiraWithEnvelopeMODEL_H_
 
-
-class HistoryItem {
-public: 
-	Vector3f atual;
-	Vector3f anterior;
-	
-	HistoryItem() {}
-};
-
 /**
  * Pamplona's Model for Pupil Light Reflex. Implementing our pupil light reflex model with an envelope.  
  * 
@@ -39,16 +30,38 @@ class PamplonaAndOliveiraWithEnvelopeModel : public PupilDynamicsModel {
 	// x = time (milliseconds) , 
 	// y = intensity (lumens), 
 	// z = pupil diameter (mm).
-	HistoryFifo<Vector3f, 1000> history;
+	HistoryFifo<PupilSample, 1000> history;
+
+	// pulses dropped by history, for latencies longer than it spans
+	HistoryArchive archive;
 	
 	float dt;
 	float phiBar;
 	float subjectBias;
 	float age;
 	bool withEnvelope;
+
+	SolverType solver;
+	bool lookupTables;
+
+	// delayed intensity and area, newest entry at or before the time
+	DelayLookup<1000> delay;
+
+	// right side for the pulse numbered fluxSequence and fluxLatency, and
+	// the delayed intensity and area it came from; fluxSequence is -1 when
+	// nothing is cached
+	long fluxSequence;
+	float fluxLatency;
+	float fluxIntensity;
+	float fluxArea;
+	float fluxRightSide;
+
+	// iterations of the last step-halving search: dD, left side, right side
+	bool debugCapture;
+	std::vector<Vector3f> debug;
 	
 public:
-	PamplonaAndOliveiraWithEnvelopeModel() : PupilDynamicsModel("Our Model With Envelope") {		
+	PamplonaAndOliveiraWithEnvelopeModel() : PupilDynamicsModel("Our Model With Envelope"), delay(true, 0.1) {		
 		init();
 	}
 	virtual ~PamplonaAndOliveiraWithEnvelopeModel() {}
@@ -58,19 +71,23 @@ public:
 		subjectBias = 0.42; // Vitor
 		withEnvelope = false;
 		age = 20;
+		solver = STEP_HALVING_SOLVER;
+		lookupTables = false;
+		debugCapture = false;
 
 		phiBar = evalPhiBar();
+		invalidateFlux();
 	}
 
 	float evalPhiBar() {
 		// Calculando PHI BARRA.
-		MoonAndSpencerModel *  moon = new MoonAndSpencerModel();
+		MoonAndSpencerModel moon;
 		// Lower intensity
 		float phiBarIntensityBlondels = powf(10, -5);
 		// To Lumens per Square MM
 		float phiBarIntensityLumensMM = Conversion::blondelToLumensSquareMillimeter(phiBarIntensityBlondels);
 		// Get pupil diameter
-		float phiBarDiameter = moon->pupilDiameterWithBlondel(phiBarIntensityBlondels);
+		float phiBarDiameter = moon.pupilDiameterWithBlondel(phiBarIntensityBlondels);
 		// apply subject variatio
 		phiBarDiameter = applySubjectPupilVariation(phiBarDiameter, subjectBias);
 		// find phiBar = Area * lumens/MM2
@@ -81,11 +98,13 @@ public:
 	void setWithEnvelope(bool v) {
 		withEnvelope = v;
 		phiBar = evalPhiBar();
+		invalidateFlux();
 	}
 	
 	void setSubjectBias(float bias) {
 		subjectBias = bias;
 		phiBar = evalPhiBar();
+		invalidateFlux();
 	}
 	
 	float getSubjectBias() {
@@ -100,13 +119,57 @@ public:
 	float getAge() {
 		return age;
 	}
+
+	void setSolver(SolverType _solver) {
+		solver = _solver;
+	}
+
+	SolverType getSolver() {
+		return solver;
+	}
+
+	/** Evaluates m(D) and the Moon bounds with the tables of LookupTables */
+	void setLookupTables(bool v) {
+		lookupTables = v;
+	}
+
+	bool usesLookupTables() {
+		return lookupTables;
+	}
+
+	/** How the delayed flux is read between history entries, see DelayLookup */
+	void setDelayInterpolation(DelayInterpolation v) {
+		delay.setInterpolation(v);
+		invalidateFlux();
+	}
+
+	DelayInterpolation getDelayInterpolation() {
+		return delay.getInterpolation();
+	}
+
+	/**
+	 * Keeps the iterations of the last step-halving search, see getDebug.
+	 * Off by default since it allocates.
+	 */
+	void setDebugCapture(bool v) {
+		debugCapture = v;
+		debug.clear();
+	}
+
+	const std::vector<Vector3f> & getDebug() {
+		return debug;
+	}
 		
 	
 	virtual bool isInLumens() { return true; }
 	
-	HistoryFifo<Vector3f, 1000> getHistory() {
+	const HistoryFifo<PupilSample, 1000> & getHistory() const {
 		return history;
 	}
+
+	const HistoryArchive & getArchive() const {
+		return archive;
+	}
 	
 	void setDt(float _dt) {
 		dt = _dt;
@@ -122,6 +185,9 @@ public:
          * Polynomial generated from Moon and Spencer data
          */
 	float evaluateMoonUpperBound(float diameterMM) {
+		if (lookupTables && LookupTables::moonUpperTable().contains(diameterMM))
+			return LookupTables::moonUpperTable().at(diameterMM);
+
 		return -0.0126725930676599 * powf(diameterMM,5)
 		     + 0.3221924543867559 * powf(diameterMM,4)
 		     + -3.0962731561456747 * powf(diameterMM,3)
@@ -134,6 +200,9 @@ public:
          * Polynomial generated from Moon and Spencer data
          */
 	float evaluateMoonLowerBound(float diameterMM) {
+		if (lookupTables && LookupTables::moonLowerTable().contains(diameterMM))
+			return LookupTables::moonLowerTable().at(diameterMM);
+
 		return -5.44158133181249E-3 * powf(diameterMM,5)
 		     + 1.38697487323348E-1 * powf(diameterMM,4)
 		     + -1.34343594792456 * powf(diameterMM,3)
@@ -142,11 +211,92 @@ public:
 		     + 1.21911721275106E+1; 
 	}	
 	
+	/** dt, phi bar, subject, envelope, solver, tables, interpolation, archive and history */
+	void saveState(CheckpointWriter & out) const {
+		out.write(dt);
+		out.write(phiBar);
+		out.write(subjectBias);
+		out.write(age);
+		out.write((uint8_t) withEnvelope);
+		out.write((int32_t) solver);
+		out.write((uint8_t) lookupTables);
+		out.write((uint8_t) delay.getInterpolation());
+		archive.saveState(out);
+		out.writeHistory(history);
+	}
+
+	bool restoreState(CheckpointReader & in) {
+		float stateDt, statePhiBar, stateBias, stateAge;
+		uint8_t stateEnvelope, stateTables, stateInterpolation;
+		int32_t stateSolver;
+
+		in.read(stateDt);
+		in.read(statePhiBar);
+		in.read(stateBias);
+		in.read(stateAge);
+		in.read(stateEnvelope);
+		in.read(stateSolver);
+		in.read(stateTables);
+		in.read(stateInterpolation);
+		if (!in.ok()) return false;
+		if (!CheckpointReader::isPositive(stateDt) || !CheckpointReader::isPositive(statePhiBar)
+		    || !std::isfinite(stateBias) || !std::isfinite(stateAge)
+		    || !CheckpointReader::isEnum(stateSolver, NEWTON_SOLVER)
+		    || !CheckpointReader::isEnum(stateInterpolation, HERMITE_DELAY)) return false;
+
+		HistoryArchive stateArchive;
+		HistoryFifo<PupilSample, 1000> stateHistory;
+		if (!stateArchive.restoreState(in) || !in.readHistory(stateHistory) || in.remaining() != 0) return false;
+
+		dt = stateDt;
+		phiBar = statePhiBar;
+		subjectBias = stateBias;
+		age = stateAge;
+		withEnvelope = stateEnvelope != 0;
+		solver = (SolverType) stateSolver;
+		lookupTables = stateTables != 0;
+		delay.setInterpolation((DelayInterpolation) stateInterpolation);
+		archive = stateArchive;
+		history = stateHistory;
+		invalidateFlux();
+		return true;
+	}
+
+	/** 10 s of history at the steady diameter for this subject's phi bar */
+	void setSteadyState(float time, float blondels) {
+		float intensity = Conversion::blondelToLumensSquareMillimeter(blondels);
+		float area = Conversion::diameterToArea(PamplonaAndOliveiraModel::steadyDiameter(blondels, phiBar));
+
+		history.clear();
+		archive.clear();
+		invalidateFlux();
+		for (int i=100; i>0; i--) {
+			addPulse(time - 100*i, intensity, area);
+		}
+	}
+
+	/** Keeps the cached right side if it belongs to an older pulse */
+	void removeLastPulse() {
+		if (history.size() > 1) {
+			if (fluxSequence >= history.sequence(history.size() - 1)) invalidateFlux();
+			history.removeLast();
+		}
+	}
+
+	void reserveHistory(int pulses) {
+		while (history.size() > 1 && history.size() > history.capacity() - pulses) {
+			archive.add(history.first());
+			history.removeFirst();
+		}
+	}
+
 	void addPulse(float mSeconds, float intensity, float area) {		
+		if (area < 2.7000f || area > 48.890f) instrumentation.recordClamp();
 		if (area < 2.7000f) area = 2.7001;
 		if (area > 48.890f) area = 48.889;
 		
-		history.add(Vector3f(mSeconds, intensity, area));
+		if (history.size() == history.capacity()) archive.add(history.first());
+		history.add(PupilSample(mSeconds, intensity, area));
 	}
 	
 	/**
@@ -159,78 +309,19 @@ public:
 		return lightIntensity * pupilArea;
 	}
 	
-	HistoryItem * getFromHistory(float latencyInMilliseconds) {
-		int size = history.history.size()-1;
-		
-		double time = history.history[size].x();
-		double fromTime = time - latencyInMilliseconds;
-		
-		HistoryItem * item = new HistoryItem();
-		for (int i=size; i>=0; i--) {
-			if (!(fromTime < history.history[i].x())) {
-				item->atual = history.history[i];
-				item->anterior = history.history[i+1];
-				
-				if (i == size) {
-					item->anterior = item->atual;
-				}
-				
-				return item;
-			}
-		}
-		return NULL;
-	}
-	
+	/**
+	 * Intensity latency ms before the last pulse, 0 when neither the
+	 * history nor the archive reach that far.
+	 */
 	float intensityAt(float latency) {
-		int size = history.history.size()-1;
-		
-		double time = history.history[size].x();
-		double fromTime = time - latency;
-		
-		HistoryItem * item = getFromHistory(latency);
-		Vector3f iAtual = item->atual;
-		Vector3f iAnterior = item->anterior;
-
-		if (item == NULL) return 0;
-		
-		float deltaTime = iAnterior.x() - iAtual.x();
-		float resto = fromTime - iAtual.x();
-
-		float percent = 0.1;
-
-		if (fabs(deltaTime) > 0.01)
-			percent = resto / deltaTime;
-				
-		// linear filter
-		float intensity = iAtual.y() + (iAnterior.y() - iAtual.y()) * percent;
+		float intensity, area;
+		if (!delay.sample(history, history.last().time - (double) latency, intensity, area, &archive)) return 0;
 		return intensity;
 	}
 	
 	float retinalFlux(float latencyInMilliseconds) {
-		int size = history.history.size()-1;
-		
-		double time = history.history[size].x();
-		double fromTime = time - latencyInMilliseconds;
-		
-		HistoryItem * item = getFromHistory(latencyInMilliseconds);
-		Vector3f iAtual = item->atual;
-		Vector3f iAnterior = item->anterior;
-
-		if (item == NULL) return 0;
-		
-		float deltaTime = iAnterior.x() - iAtual.x();
-		float resto = fromTime - iAtual.x();
-
-		float percent = 0.1;
-
-		if (fabs(deltaTime) > 0.01)
-			percent = resto / deltaTime;
-				
-		// linear filter
-		float intensity = iAtual.y() + (iAnterior.y() - iAtual.y()) * percent;
-		float area 		= iAtual.z() + (iAnterior.z() - iAtual.z()) * percent;
-	
-		return retinalFlux(intensity, area);
+		instrumentation.recordLookup();
+		return delay.flux(history, history.last().time - (double) latencyInMilliseconds, &archive);
 	}
 	
 	float logarithmOfRetinalFluxRate(float latency) {
@@ -241,6 +332,47 @@ public:
 	float muscleActivity(float latency) {
 		return 5.2 - 0.45 * logarithmOfRetinalFluxRate(latency); 
 	}
+
+	/**
+	 * muscleActivity(latency) for the step after the last pulse, kept
+	 * between calls. Another solve from the same pulse with the same
+	 * latency, as the step doubling of AdaptiveStepper does, reuses it; a
+	 * delayed intensity and area equal to the last ones, as under a steady
+	 * light, reuse its logarithm. The cache is not carried to a new pulse:
+	 * its right side reads the history again, through the cursor of
+	 * DelayLookup, which walks from the previous bracket.
+	 */
+	float delayedMuscleActivity(float latency) {
+		long sequence = history.sequence(history.size() - 1);
+		if (sequence == fluxSequence && latency == fluxLatency) {
+			instrumentation.recordFluxReuse();
+			return fluxRightSide;
+		}
+
+		instrumentation.recordLookup();
+		float intensity, area;
+		if (!delay.sample(history, history.last().time - (double) latency, intensity, area, &archive)) {
+			// no pulse that old: muscleActivity(latency) with the flux of 0
+			// retinalFlux gives, without reading the history again
+			invalidateFlux();
+			return 5.2 - 0.45 * log(0.0f / phiBar);
+		}
+
+		if (fluxSequence < 0 || intensity != fluxIntensity || area != fluxArea) {
+			instrumentation.recordFluxLogarithm();
+			fluxIntensity = intensity;
+			fluxArea = area;
+			float logarithm = log(intensity * area / phiBar);
+			fluxRightSide = 5.2 - 0.45 * logarithm;
+		}
+		fluxSequence = sequence;
+		fluxLatency = latency;
+		return fluxRightSide;
+	}
+
+	void invalidateFlux() {
+		fluxSequence = -1;
+	}
 	
 	float getLumens(float diameter) {
 		return 0;
@@ -251,14 +383,15 @@ public:
 	}
 
 	float m(float diameter) {
+		if (lookupTables && LookupTables::mTable().contains(diameter))
+			return LookupTables::mTable().at(diameter);
+
 		return arcTanH((diameter - 4.9) / 3);
 	}
 
 	float evaluateLeftSide(float time, float dD, float latency) {
-		int size = history.history.size()-1;
-		
-		float dT = (time - history.history[size].x()) / 600.0f;
-		float prevDiammeter = Conversion::areaToDiameter(history.history[history.history.size()-1].z());
+		float dT = (time - history.last().time) / 600.0f;
+		float prevDiammeter = Conversion::areaToDiameter(history.last().area);
 
 		float diameter = prevDiammeter + dD;
 		float prevM = m(prevDiammeter);
@@ -289,22 +422,42 @@ public:
 	
 	float evaluateDiameter(float latency, float time) {
 		// Compute the right side of the equation. This will not change.
-		float rightSide = muscleActivity(latency);
+		float rightSide;
+		{
+			ScopedModelTimer timer(instrumentation, RIGHT_SIDE_TIMER);
+			rightSide = delayedMuscleActivity(latency);
+		}
+		ScopedModelTimer timer(instrumentation, SOLVER_TIMER);
 		float leftSide;
+
+		if (solver == NEWTON_SOLVER) {
+			float prevDiameter = Conversion::areaToDiameter(history.last().area);
+			float dT = (time - history.last().time) / 600.0f;
+
+			int iterations;
+			RootStatus status;
+			float diameter = PamplonaAndOliveiraModel::solveDiameterWithNewton(prevDiameter, dT, rightSide, iterations, status, 0.0000000001, lookupTables);
+
+			instrumentation.recordSolve(iterations);
+			if (status == ROOT_NOT_CONVERGED) instrumentation.recordUnconverged();
+			if (status == ROOT_FAILED) instrumentation.recordDivergence(time, prevDiameter, rightSide);
+			return diameter;
+		}
 				
 		double dD = 0;
 		float pass = 1.0f;
 		float leftSideAnt = 0;
 		float operation = 1;
 		
-		std::vector<Vector3f> debug;
+		debug.clear();
 		
 		for (int i=0; i<100; i++) {
 			leftSide = evaluateLeftSide(time, dD, latency);
 		
 			// If it found the right value, return.
 			if (equals(leftSide, rightSide, 0.001)) {
-				float prevDiameter = Conversion::areaToDiameter((history.history.end()-1)->z());
+				instrumentation.recordSolve(i+1);
+				float prevDiameter = Conversion::areaToDiameter(history.last().area);
 				return prevDiameter+dD;
 			}
 			
@@ -327,7 +480,8 @@ public:
 						// check if a solution is possible
 						if ((operation < 0 && leftSide > rightSide)
 						||  (operation > 0 && leftSide < rightSide)) {
-							float prevDiameter = Conversion::areaToDiameter((history.history.end()-1)->z());
+							instrumentation.recordSolve(i+1);
+							float prevDiameter = Conversion::areaToDiameter(history.last().area);
 							return prevDiameter+dD;
 						}
 						
@@ -344,26 +498,25 @@ public:
 			
 			// store the value
 			leftSideAnt = leftSide;
-			debug.push_back(Vector3f(dD, leftSide, rightSide));
-		}
-		
-		std::vector<Vector3f>::iterator i = debug.begin();
-		for (; i != debug.end(); i++) {
-			std::cout << "Debug: " << i->x() << " " << i->y() << " " << i->z() << std::endl;
+			if (debugCapture) debug.push_back(Vector3f(dD, leftSide, rightSide));
 		}
-		std::cout << "No Convergiu: " << dD << " " << pass << " "<< leftSide << " "<< rightSide << " " << std::endl;
 		
 		// If fails, returns the previous valid area.
-		float prevDiameter = Conversion::areaToDiameter((history.history.end()-1)->z());
+		float prevDiameter = Conversion::areaToDiameter(history.last().area);
+		instrumentation.recordSolve(100);
+		instrumentation.recordDivergence(time, prevDiameter, rightSide);
 		return prevDiameter;
 	}
 	
 	float pupilDiameterAt(float intensity, float latency, float time) {
+		ScopedModelTimer timer(instrumentation, STEP_TIMER);
+		instrumentation.recordStep();
 		float diameter = evaluateDiameter(latency, time);
 		
 		addPulse(time,intensity, Conversion::diameterToArea(diameter));
 
 		diameter = applySubjectPupilVariation(diameter, subjectBias);
+		trace(time, intensity, history.last().area, diameter, latency, instrumentation.lastIterations);
 		return diameter;
 	}
 	
@@ -38,6 +38,25 @@ public:
 	virtual float pupilDiameterAt(float lightIntensity) {
 		return 5.0f - 3.0f*tanh(0.4*log10(Conversion::blondelToCandelaSquareMeter(lightIntensity)));
 	} 	
+
+	/**
+	 * Intensities in Blondels
+	 */
+	virtual void pupilDiameterAt(const float * intensities, float * diameters, size_t n) {
+		size_t i = 0;
+#ifdef PLR_SIMD
+		// log10 of the conversion to cd/m2, folded in the constant
+		FloatPack log10OfCandelaPerBlondel(-0.49714987f);
+		for (; i + FLOAT_PACK_WIDTH <= n; i += FLOAT_PACK_WIDTH) {
+			FloatPack intensity = FloatPack::load(intensities + i);
+			FloatPack diameter = FloatPack(5.0f) - FloatPack(3.0f)*tanh(FloatPack(0.4f)*(log10(intensity) + log10OfCandelaPerBlondel));
+			diameter.store(diameters + i);
+		}
+#endif
+		for (; i < n; i++) {
+			diameters[i] = PokornyAndSmithModel::pupilDiameterAt(intensities[i]);
+		}
+	}
 };
 
 #endif /*MOONANDSPENCERMODEL_H_*/
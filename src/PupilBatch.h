@@ -0,0 +1,279 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PUPILBATCH_H_
+#define PUPILBATCH_H_
+
+#include <vector>
+
+/**
+ * Steps many independent pupils of Pamplona's model (Equation 16) together.
+ *
+ * Instead of one PamplonaAndOliveiraModel per pupil, the histories are kept
+ * as structure of arrays: one ring of sample times shared by all pupils,
+ * since they are stepped in lockstep, and one row of intensities and one row
+ * of areas per time sample, each row holding all pupils side by side.
+ *
+ * Stepping a batch gives the same diameters as stepping the same number of
+ * PamplonaAndOliveiraModel instances with the same inputs. When vectorized,
+ * diameters are within the tolerance of PamplonaAndOliveiraBatchSolver.
+ */
+class PupilBatch {
+	int pupils;
+	int limit;
+
+	// Ring of time samples (milliseconds). Row r of intensities and areas
+	// holds the pulses of all pupils at times[r].
+	std::vector<float> times;
+	std::vector<float> intensities;	// lumens/mm2
+	std::vector<float> areas;		// mm2
+	std::vector<float> diameters;	// mm, result of the last step
+
+	// Equation 16 inputs of the current step
+	std::vector<float> prevDiameters;
+	std::vector<float> rightSides;
+
+	int first;
+	int count;
+
+	double minimumThreshold;
+
+	bool vectorized;
+	SolverType solver;
+	long divergences;
+
+	inline int position(int index) const {
+		int pos = first + index;
+		if (pos >= limit) pos -= limit;
+		return pos;
+	}
+
+	/** Binary search for the newest sample whose time is <= time. */
+	int lastIndexAtOrBefore(double time) const {
+		int low = 0;
+		int high = count;
+		while (low < high) {
+			int middle = (low + high) / 2;
+			if (time < times[position(middle)])
+				high = middle;
+			else
+				low = middle + 1;
+		}
+		return low - 1;
+	}
+
+	/** Reserves the row of a new time sample, dropping the oldest when full. */
+	int newRow(float time) {
+		int row;
+		if (count < limit) {
+			row = position(count);
+			count++;
+		} else {
+			row = first;
+			first++;
+			if (first == limit) first = 0;
+		}
+		times[row] = time;
+		return row;
+	}
+
+	/** Same linear filter used by PamplonaAndOliveiraModel::retinalFlux */
+	float retinalFlux(int pupil, double fromTime, int i) const {
+		if (i < 0) return 0;
+
+		int atual = position(i);
+		int anterior = i < count-1 ? position(i+1) : atual;
+
+		float deltaTime = times[anterior] - times[atual];
+		float resto = fromTime - times[atual];
+
+		float percent = 0.1;
+
+		if (fabs(deltaTime) > 0.01)
+			percent = resto / deltaTime;
+
+		float iAtual = intensities[atual * pupils + pupil];
+		float aAtual = areas[atual * pupils + pupil];
+		float intensity = iAtual + (intensities[anterior * pupils + pupil] - iAtual) * percent;
+		float area      = aAtual + (areas[anterior * pupils + pupil] - aAtual) * percent;
+
+		return intensity * area;
+	}
+
+	static float clampArea(float area) {
+		if (area < 2.7000f) area = 2.7001;
+		if (area > 48.890f) area = 48.889;
+		return area;
+	}
+
+public:
+	PupilBatch(int _pupils, int historyLimit = 1000) :
+		pupils(_pupils), limit(historyLimit),
+		times(historyLimit), intensities(historyLimit * _pupils), areas(historyLimit * _pupils),
+		diameters(_pupils), prevDiameters(_pupils), rightSides(_pupils), first(0), count(0) {
+		minimumThreshold = PamplonaAndOliveiraModel::evalPhiBar();
+		vectorized = false;
+		solver = STEP_HALVING_SOLVER;
+		divergences = 0;
+	}
+	virtual ~PupilBatch() {}
+
+	int size() const {
+		return pupils;
+	}
+
+	int historySize() const {
+		return count;
+	}
+
+	/**
+	 * Solves all pupils with PamplonaAndOliveiraBatchSolver instead of the
+	 * scalar solver of PamplonaAndOliveiraModel.
+	 */
+	void setVectorized(bool v) {
+		vectorized = v;
+	}
+
+	bool isVectorized() const {
+		return vectorized;
+	}
+
+	/** Solver used when the batch is not vectorized */
+	void setSolver(SolverType _solver) {
+		solver = _solver;
+	}
+
+	SolverType getSolver() const {
+		return solver;
+	}
+
+	/** Number of pupil steps in which the solver diverged */
+	long getDivergences() const {
+		return divergences;
+	}
+
+	/** Time of the last pulse, 0 before the first one */
+	float getTime() const {
+		if (count == 0) return 0;
+		return times[position(count-1)];
+	}
+
+	/**
+	 * Seeds the same pulse on every pupil.
+	 * intensity in lumens/mm2, area in mm2.
+	 */
+	void addPulse(float time, float intensity, float area) {
+		int row = newRow(time) * pupils;
+		area = clampArea(area);
+		for (int p=0; p<pupils; p++) {
+			intensities[row + p] = intensity;
+			areas[row + p] = area;
+			diameters[p] = Conversion::areaToDiameter(area);
+		}
+	}
+
+	/**
+	 * Seeds one pulse per pupil.
+	 */
+	void addPulse(float time, const float * pulseIntensities, const float * pulseAreas) {
+		int row = newRow(time) * pupils;
+		for (int p=0; p<pupils; p++) {
+			intensities[row + p] = pulseIntensities[p];
+			areas[row + p] = clampArea(pulseAreas[p]);
+			diameters[p] = Conversion::areaToDiameter(areas[row + p]);
+		}
+	}
+
+	/**
+	 * Advances every pupil by dt milliseconds with the same latency.
+	 * stepIntensities holds one intensity (lumens/mm2) per pupil. Does
+	 * nothing until a pulse was seeded with addPulse.
+	 */
+	void step(float dt, const float * stepIntensities, float latency) {
+		if (count == 0) return;
+		int last = position(count-1);
+		float time = times[last] + dt;
+		double fromTime = (double) times[last] - latency;
+
+		// All pupils share the sample times, so the bracket is found once.
+		int i = lastIndexAtOrBefore(fromTime);
+		float dT = (time - times[last]) / 500.0f;
+
+		for (int p=0; p<pupils; p++) {
+			rightSides[p] = PamplonaAndOliveiraModel::muscleActivityForFlux(retinalFlux(p, fromTime, i), minimumThreshold);
+			prevDiameters[p] = Conversion::areaToDiameter(areas[last * pupils + p]);
+		}
+
+		solve(dT);
+		storeStep(time, stepIntensities);
+	}
+
+	/**
+	 * Advances every pupil by dt milliseconds, each one with its own latency.
+	 * Does nothing until a pulse was seeded with addPulse.
+	 */
+	void step(float dt, const float * stepIntensities, const float * latencies) {
+		if (count == 0) return;
+		int last = position(count-1);
+		float time = times[last] + dt;
+		float dT = (time - times[last]) / 500.0f;
+
+		for (int p=0; p<pupils; p++) {
+			double fromTime = (double) times[last] - latencies[p];
+			int i = lastIndexAtOrBefore(fromTime);
+
+			rightSides[p] = PamplonaAndOliveiraModel::muscleActivityForFlux(retinalFlux(p, fromTime, i), minimumThreshold);
+			prevDiameters[p] = Conversion::areaToDiameter(areas[last * pupils + p]);
+		}
+
+		solve(dT);
+		storeStep(time, stepIntensities);
+	}
+
+	/** Pupil diameters in mm after the last step */
+	const float * getDiameters() const {
+		return &diameters[0];
+	}
+
+	float getDiameter(int pupil) const {
+		return diameters[pupil];
+	}
+
+private:
+	void solve(float dT) {
+		if (vectorized) {
+			divergences += PamplonaAndOliveiraBatchSolver::solveDiameters(&prevDiameters[0], dT, &rightSides[0], &diameters[0], pupils);
+		} else {
+			int iterations;
+			bool diverged;
+			for (int p=0; p<pupils; p++) {
+				diameters[p] = PamplonaAndOliveiraModel::solveDiameter(solver, prevDiameters[p], dT, rightSides[p], iterations, diverged);
+				if (diverged) divergences++;
+			}
+		}
+	}
+
+	void storeStep(float time, const float * stepIntensities) {
+		int row = newRow(time) * pupils;
+		for (int p=0; p<pupils; p++) {
+			intensities[row + p] = stepIntensities[p];
+			areas[row + p] = clampArea(Conversion::diameterToArea(diameters[p]));
+		}
+	}
+};
+
+#endif /*PUPILBATCH_H_*/
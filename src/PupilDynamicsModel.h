@@ -23,9 +23,18 @@
  */
 class PupilDynamicsModel {
 	std::string name;
+
+protected:
+	PupilTraceWriter * traceWriter;
+	ModelInstrumentation instrumentation;
+
+	/** Appends a step to the trace, if any */
+	void trace(float time, float intensity, float area, float diameter, float latency, int iterations) {
+		if (traceWriter != NULL) traceWriter->append(time, intensity, area, diameter, latency, iterations);
+	}
 	
 public:
-	PupilDynamicsModel(std::string _name) { name = _name; }
+	PupilDynamicsModel(std::string _name) : traceWriter(NULL) { name = _name; }
 	virtual ~PupilDynamicsModel() {}
 	
 	/**
@@ -37,10 +46,84 @@ public:
 	} 
 	
 	virtual float pupilDiameterAt(float intensity, float latency, float time) {
-		return pupilDiameterAt(intensity);
+		instrumentation.recordStep();
+		float diameter = pupilDiameterAt(intensity);
+		trace(time, intensity, Conversion::diameterToArea(diameter), diameter, latency, 0);
+		return diameter;
 	}	
+
+	/**
+	 * Diameters (mm) of n intensities at once, for the models that only
+	 * depend on the intensity. Static models override it with SIMD code.
+	 */
+	virtual void pupilDiameterAt(const float * intensities, float * diameters, size_t n) {
+		for (size_t i=0; i<n; i++) {
+			diameters[i] = pupilDiameterAt(intensities[i]);
+		}
+	}
 	
-	std::string getName() {
+	/**
+	 * Records the pupil area (mm2) reached at mSeconds under intensity.
+	 * Only delay models keep a history, the others ignore it.
+	 */
+	virtual void addPulse(float mSeconds, float intensity, float area) {}
+
+	/**
+	 * Fills the history of a delay model as if the pupil had rested under
+	 * a constant luminance, in blondels, until time. The other models keep
+	 * no history.
+	 */
+	virtual void setSteadyState(float time, float blondels) {}
+
+	/** Undoes the last addPulse, to retry a step. See AdaptiveStepper. */
+	virtual void removeLastPulse() {}
+
+	/**
+	 * Archives the oldest pulses of a delay model until pulses more fit in
+	 * its history, so that removeLastPulse undoes them without losing any.
+	 */
+	virtual void reserveHistory(int pulses) {}
+
+	/**
+	 * Writes the state the model needs to resume stepping, see
+	 * ModelCheckpoint. Models without a history have none.
+	 */
+	virtual void saveState(CheckpointWriter & out) const {}
+
+	/**
+	 * Reads back the state of saveState, which must end the blob. Returns
+	 * false, leaving the model unchanged, if a field is missing or invalid
+	 * or bytes follow the state.
+	 */
+	virtual bool restoreState(CheckpointReader & in) {
+		return in.ok() && in.remaining() == 0;
+	}
+
+	/**
+	 * Every step of pupilDiameterAt(intensity, latency, time) is appended
+	 * to writer, which the model does not own. NULL stops tracing.
+	 */
+	void setTraceWriter(PupilTraceWriter * writer) {
+		traceWriter = writer;
+	}
+
+	PupilTraceWriter * getTraceWriter() {
+		return traceWriter;
+	}
+
+	/** Counters and timers of the steps, see ModelInstrumentation */
+	ModelInstrumentation & getInstrumentation() {
+		return instrumentation;
+	}
+
+	/** The model name and its instrumentation as a JSON object */
+	void writeInstrumentation(std::ostream & out) const {
+		out << "{\"model\": \"" << name << "\", \"counters\": ";
+		instrumentation.writeJson(out);
+		out << "}";
+	}
+
+	const std::string & getName() const {
 		return name; 
 	}
 	
@@ -26,6 +26,7 @@
 #include <sstream>
 #include <string>
 #include <cstdlib>
+#include <algorithm>
 
 #include <cmath>
 
@@ -33,9 +34,15 @@
 
 #include "Singleton.h"
 #include "Vector.h"
+#include "PupilSample.h"
 #include "Util.h"
 #include "Conversion.h"
 
+#include "SimdMath.h"
+#include "PupilTrace.h"
+#include "Checkpoint.h"
+#include "ModelInstrumentation.h"
+
 #include "PupilDynamicsModel.h"
 #include "MoonAndSpencerModel.h"
 #include "ReevesModel.h"
@@ -43,168 +50,286 @@
 #include "DegrootAndGebhardModel.h"
 
 #include "HistoryFifo.h"
+#include "HistoryArchive.h"
+#include "DelayLookup.h"
+#include "StimulusQueue.h"
+#include "RootFinder.h"
+#include "LookupTables.h"
 #include "LongtinAndMiltonModel.h"
 #include "PamplonaAndOliveiraModel.h"
 #include "PamplonaAndOliveiraWithEnvelopeModel.h"
+#include "PamplonaAndOliveiraBatchSolver.h"
+#include "PupilBatch.h"
+#include "AdaptiveStepper.h"
 
 #include "LatencyModel.h"
 #include "LinkAndStarkModel.h"
 #include "EllisModel.h"
+#include "TabulatedLatencyModel.h"
+#include "ModelRegistry.h"
+#include "ModelCheckpoint.h"
 
 #include "PupilLifecycleInterface.h"
 
 /**
  * Holds on all pupil dynamic factors.
+ *
+ * Each subject owns its own PupilLifecycle. Instances share no mutable
+ * state, so different lifecycles can be stepped on different threads. A
+ * lifecycle owns its models: it can be moved but not copied, and a
+ * moved-from lifecycle can only be destroyed or assigned to.
+ *
+ * See StaticPupilLifecycle for a lifecycle whose models are known at
+ * compile time.
  */
-class PupilLifecycle : public Singleton<PupilLifecycle>, public PupilLifecycleInterface {
+class PupilLifecycle : public PupilLifecycleInterface {
 	PupilDynamicsModel * dynamics;
 	LatencyModel * latency;
 
-	// Frequency in cd/mm2;
-	float intensity;
-	//float newIntensity;
+	PupilModelId dynamicsId;
+	LatencyModelId latencyId;
+
+	// latency model wrapped in a TabulatedLatencyModel
+	bool latencyTables;
 
-	std::vector<Vector2f> latencyFifo;
+	// Frequency in cd/mm2, applied once their latency passed
+	StimulusQueue latencyFifo;
 
 public:
-	PupilLifecycle()  {
-		dynamics = new MoonAndSpencerModel();
-		latency = new LinkAndStarkModel(0.4);
+	PupilLifecycle() : PupilLifecycle(PupilModelId::MOON_AND_SPENCER, LatencyModelId::LINK_AND_STARK) {}
+
+	/**
+	 * Delay models start at time dark adapted, see setPupilModel, and see
+	 * a 10 blondels stimulus at time.
+	 */
+	PupilLifecycle(PupilModelId dynamicsModel, LatencyModelId latencyModel, float time = 0) :
+		PupilLifecycle(dynamicsModel, latencyModel, time, TabulatedFunctions::DARK_BLONDELS, powf(10, 1)) {}
+
+	/** Starts adapted to, and lit by, ambient blondels */
+	PupilLifecycle(PupilModelId dynamicsModel, LatencyModelId latencyModel, float time, float ambient) :
+		PupilLifecycle(dynamicsModel, latencyModel, time, ambient, ambient) {}
+
+	PupilLifecycle(PupilModelId dynamicsModel, LatencyModelId latencyModel, float time, float ambient, float stimulus) {
+		dynamics = NULL;
+		latency = NULL;
+		latencyTables = false;
+
+		setPupilModel(dynamicsModel, time, ambient);
+		setLatencyModel(latencyModel);
+
+		setIntensity(stimulus, time);
+	}
+
+	PupilLifecycle(PupilLifecycle && other) noexcept :
+		dynamics(other.dynamics), latency(other.latency),
+		dynamicsId(other.dynamicsId), latencyId(other.latencyId), latencyTables(other.latencyTables),
+		latencyFifo(std::move(other.latencyFifo)) {
+		other.dynamics = NULL;
+		other.latency = NULL;
+	}
+
+	PupilLifecycle & operator=(PupilLifecycle && other) noexcept {
+		std::swap(dynamics, other.dynamics);
+		std::swap(latency, other.latency);
+		std::swap(dynamicsId, other.dynamicsId);
+		std::swap(latencyId, other.latencyId);
+		std::swap(latencyTables, other.latencyTables);
+		std::swap(latencyFifo, other.latencyFifo);
+		return *this;
+	}
+
+	PupilLifecycle(const PupilLifecycle &) = delete;
+	PupilLifecycle & operator=(const PupilLifecycle &) = delete;
+
+	virtual ~PupilLifecycle() {
+		delete dynamics;
+		delete latency;
+	}
+
+	/**
+	 * Lifecycle shared by the whole program, for the code written when
+	 * PupilLifecycle was a Singleton. Created on first use.
+	 */
+	static PupilLifecycle & getSingleton() {
+		static PupilLifecycle singleton;
+		return singleton;
+	}
+
+	static PupilLifecycle & getInstance() {
+		return getSingleton();
+	}
 
-		intensity = 0.0f;
+	static PupilLifecycle * getSingletonPtr() {
+		return &getSingleton();
+	}
 
-		setIntensity(powf(10, 1), 0);
-		//newIntensity = 0.0f;
+	static PupilLifecycle * getInstancePtr() {
+		return &getSingleton();
 	}
-	virtual ~PupilLifecycle() {}
 
-	std::string pupilModel() {
+	const std::string & pupilModel() {
 		return dynamics->getName();
 	}
 
-	std::string latencyModel() {
+	const std::string & latencyModel() {
 		return latency->getName();
 	}
 
+	PupilModelId getPupilModelId() {
+		return dynamicsId;
+	}
+
+	LatencyModelId getLatencyModelId() {
+		return latencyId;
+	}
+
 	PupilDynamicsModel * getDynamics() {
 		return dynamics;
 	}
 
-	void setEllisModel() {
+	/**
+	 * Replaces the pupil model. Delay models start adapted to the ambient
+	 * luminance in blondels, dark by default, with 10 s of history before
+	 * time. See PupilDynamicsModel::setSteadyState.
+	 */
+	void setPupilModel(PupilModelId id, float time, float ambient = TabulatedFunctions::DARK_BLONDELS) {
+		delete dynamics;
+		dynamics = ModelRegistry::create(id);
+		dynamicsId = id;
+
+		if (ModelRegistry::info(id).stateful) {
+			latencyFifo.intensity = ambient;
+			dynamics->setSteadyState(time, ambient);
+		}
+	}
+
+	void setLatencyModel(LatencyModelId id) {
 		delete latency;
-		latency = new EllisModel();
+		latency = ModelRegistry::create(id);
+		if (latencyTables) latency = new TabulatedLatencyModel(latency);
+		latencyId = id;
+	}
+
+	/**
+	 * Reads the latency from a table instead of the model, within a
+	 * few thousandths of a ms. See TabulatedLatencyModel.
+	 */
+	void setLatencyTables(bool v) {
+		latencyTables = v;
+		setLatencyModel(latencyId);
+	}
+
+	void setEllisModel() {
+		setLatencyModel(LatencyModelId::ELLIS);
 	}
 
 	void setLinkModel() {
-		delete latency;
-		latency = new LinkAndStarkModel(0.4);
+		setLatencyModel(LatencyModelId::LINK_AND_STARK);
 	}
 
 	void setMoonModel() {
-		delete dynamics;
-		dynamics = new MoonAndSpencerModel();
+		setPupilModel(PupilModelId::MOON_AND_SPENCER, 0);
 	}
 
 	void setGrootModel() {
-		delete dynamics;
-		dynamics = new DegrootAndGebhardModel();
+		setPupilModel(PupilModelId::DEGROOT_AND_GEBHARD, 0);
 	}
 
 	void setPokornyModel() {
-		delete dynamics;
-		dynamics = new PokornyAndSmithModel();
+		setPupilModel(PupilModelId::POKORNY_AND_SMITH, 0);
 	}
 
 	void setReevesModel() {
-		delete dynamics;
-		dynamics = new ReevesModel();
+		setPupilModel(PupilModelId::REEVES, 0);
 	}
 
-	void setPamplonaModel(float time) {
-		delete dynamics;
-		dynamics = new PamplonaAndOliveiraModel();
-
-		float area = 48;
-		intensity = Conversion::blondelToLumensSquareMillimeter(pow(10.0f, -5.0f));
-
-		for (int i=100; i>0; i--) {
-			((PamplonaAndOliveiraModel *)dynamics)->addPulse(time - 100*i, intensity, area);
-		}
+	void setPamplonaModel(float time, float ambient = TabulatedFunctions::DARK_BLONDELS) {
+		setPupilModel(PupilModelId::PAMPLONA_AND_OLIVEIRA, time, ambient);
 	}
 
-	void setPamplonaEnvelopeModel(float time) {
-		delete dynamics;
-		dynamics = new PamplonaAndOliveiraWithEnvelopeModel();
-		((PamplonaAndOliveiraWithEnvelopeModel *) dynamics)->setWithEnvelope(true);
-
-		float area = 48;
-		intensity = Conversion::blondelToLumensSquareMillimeter(pow(10.0f, -5.0f));
-
-		for (int i=100; i>0; i--) {
-			((PamplonaAndOliveiraModel *)dynamics)->addPulse(time - 100*i, intensity, area);
-		}
+	void setPamplonaEnvelopeModel(float time, float ambient = TabulatedFunctions::DARK_BLONDELS) {
+		setPupilModel(PupilModelId::PAMPLONA_AND_OLIVEIRA_WITH_ENVELOPE, time, ambient);
 	}
 
-	void setLongtinModel(float time) {
-		delete dynamics;
-
-		dynamics = new LongtinAndMiltonModel();
-
-		float area = 48;
-		intensity = Conversion::blondelToLumensSquareMillimeter(pow(10.0f, -5.0f));
-
-		for (int i=100; i>0; i--) {
-			((LongtinAndMiltonModel *)dynamics)->addPulse(time - 100*i, intensity, area);
-		}
+	void setLongtinModel(float time, float ambient = TabulatedFunctions::DARK_BLONDELS) {
+		setPupilModel(PupilModelId::LONGTIN_AND_MILTON, time, ambient);
 	}
 
 	/**
 	 * Intensity in Cd/mm2
 	 */
 	void setIntensity(float _intensity, float time) {
-		latencyFifo.push_back(Vector2f(time + (int)latency->pupilLatencyAt(_intensity), _intensity));
+		latencyFifo.add(time + (int)latency->pupilLatencyAt(_intensity), _intensity);
 	}
 
-	void nextPupilModel(float timeInMilliseconds) {
-		if (pupilModel() == "Degroot And Gebhard"){
-			setReevesModel();
-		} else if (pupilModel() == "Reeves"){
-			 setMoonModel();
-		} else if (pupilModel() == "Moon And Spencer"){
-			 setPamplonaModel(timeInMilliseconds);
-		} else if (pupilModel() == "Our Model"){
-			 setPamplonaEnvelopeModel(timeInMilliseconds);
-		} else if (pupilModel() == "Our Model With Envelope"){
-			 setPokornyModel();
-		} else if (pupilModel() == "Pokorny And Smith"){
-			 setLongtinModel(timeInMilliseconds);
-		} else if (pupilModel() == "Longtin And Milton"){
-			 setGrootModel();
+	/**
+	 * Replaces blob with a snapshot of the model ids, the pending stimuli
+	 * and the state of the pupil model. See ModelCheckpoint.
+	 */
+	void checkpoint(std::vector<char> & blob) const {
+		blob.clear();
+		CheckpointWriter out(blob);
+		ModelCheckpoint::writeHeader(out, ModelCheckpoint::LIFECYCLE);
+		out.write((uint8_t) dynamicsId);
+		out.write((uint8_t) latencyId);
+		latencyFifo.saveState(out);
+		dynamics->saveState(out);
+		ModelCheckpoint::finish(blob);
+	}
+
+	/**
+	 * Continues from a snapshot of checkpoint, replacing the models if the
+	 * ids differ. Returns false, leaving the lifecycle unchanged, if blob
+	 * is not a valid snapshot.
+	 */
+	bool restore(const std::vector<char> & blob) {
+		CheckpointReader in = ModelCheckpoint::open(blob, ModelCheckpoint::LIFECYCLE);
+		uint8_t stateDynamics, stateLatency;
+		in.read(stateDynamics);
+		in.read(stateLatency);
+		if (!in.ok() || stateDynamics >= ModelRegistry::PUPIL_MODELS
+		              || stateLatency >= ModelRegistry::LATENCY_MODELS) return false;
+
+		StimulusQueue stateFifo;
+		if (!stateFifo.restoreState(in)) return false;
+
+		// the model state ends the blob, and a model restores all or nothing
+		PupilModelId stateDynamicsId = (PupilModelId) stateDynamics;
+		PupilDynamicsModel * restored = stateDynamicsId != dynamicsId ? ModelRegistry::create(stateDynamicsId) : dynamics;
+		if (!restored->restoreState(in)) {
+			if (restored != dynamics) delete restored;
+			return false;
 		}
+
+		if (restored != dynamics) {
+			delete dynamics;
+			dynamics = restored;
+			dynamicsId = stateDynamicsId;
+		}
+		if ((LatencyModelId) stateLatency != latencyId) {
+			setLatencyModel((LatencyModelId) stateLatency);
+		}
+		latencyFifo = std::move(stateFifo);
+		return true;
+	}
+
+	void nextPupilModel(float timeInMilliseconds) {
+		setPupilModel(ModelRegistry::info(dynamicsId).next, timeInMilliseconds);
 	}
 
 	void nextLatencyModel() {
-		if (latencyModel() == "Ellis"){
-			 setLinkModel();
-		} else if (latencyModel() == "Link And Stark"){
-			 setEllisModel();
-		}
+		setLatencyModel(ModelRegistry::info(latencyId).next);
 	}
 
 	/** Returns the pupil diameter in mm.
 	 */
 	float getDiameter(float time) {
-		std::vector<Vector2f>:: iterator i;
-		for (i = latencyFifo.begin(); i< latencyFifo.end(); i++) {
-			if (time > i->x()) {
-				intensity = i->y();
-			}
-		}
+		latencyFifo.apply(time);
+		float intensity = latencyFifo.intensity;
 
 		if (dynamics->isInLumens()) {
-			float freshIntensity = latencyFifo.size() > 0 ? latencyFifo[latencyFifo.size()-1].y() : intensity;
-			freshIntensity = Conversion::blondelToLumensSquareMillimeter(freshIntensity);
-			return dynamics->pupilDiameterAt(freshIntensity, latency->pupilLatencyAt(intensity), time);
+			float freshLumens = Conversion::blondelToLumensSquareMillimeter(latencyFifo.freshIntensity);
+			return dynamics->pupilDiameterAt(freshLumens, latency->pupilLatencyAt(intensity), time);
 		} else {
 			return dynamics->pupilDiameterAt(intensity, latency->pupilLatencyAt(intensity), time);
 		}
@@ -216,4 +341,8 @@ public:
 	}
 };
 
+#include "StaticPupilLifecycle.h"
+#include "PupilScheduler.h"
+#include "StimulusTrace.h"
+
 #endif /*PUPILLIFECYCLE_H_*/
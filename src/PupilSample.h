@@ -0,0 +1,49 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PUPILSAMPLE_H_
+#define PUPILSAMPLE_H_
+
+#include <type_traits>
+
+/**
+ * One step in the history of a delay model: the time in milliseconds, the
+ * intensity seen by the pupil and the pupil area reached, in mm2.
+ *
+ * Three packed floats with no vtable, so a 1000 step history takes 12 KB
+ * and is copied, checkpointed and scanned as plain memory.
+ */
+class PupilSample {
+public:
+	float time;
+	float intensity;
+	float area;
+
+	PupilSample() = default;
+
+	constexpr PupilSample(float _time, float _intensity, float _area) :
+		time(_time), intensity(_intensity), area(_area) {}
+};
+
+static_assert(std::is_trivial<PupilSample>::value && sizeof(PupilSample) == 3 * sizeof(float),
+              "PupilSample must stay three packed floats");
+
+inline double historyTime(const PupilSample & sample) {
+	return sample.time;
+}
+
+#endif /*PUPILSAMPLE_H_*/
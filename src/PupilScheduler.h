@@ -0,0 +1,337 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PUPILSCHEDULER_H_
+#define PUPILSCHEDULER_H_
+
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <unistd.h>
+
+/**
+ * Time spent by one worker of PupilScheduler in the last frame.
+ */
+class WorkerStatistics {
+public:
+	double busySeconds;	// stepping pupils
+	int chunks;			// chunks stepped
+	int stolen;			// of which taken from other workers
+
+	WorkerStatistics() { clear(); }
+
+	void clear() {
+		busySeconds = 0;
+		chunks = 0;
+		stolen = 0;
+	}
+};
+
+/**
+ * Steps many pupils every frame on a pool of threads.
+ *
+ * Pupils are PupilLifecycle instances, stepped with getDiameter(time,
+ * intensity), or PupilDynamicsModel instances with their own latency,
+ * stepped with pupilDiameterAt(intensity, latency, time). They are not
+ * owned by the scheduler, and each one must be added only once.
+ *
+ * Pupils are split into chunks of consecutive pupils. At every frame the
+ * chunks are dealt to the workers in contiguous runs; a worker takes its
+ * chunks from the back of its own deque and, once it runs out, steals from
+ * the front of the others. A pupil whose solver needs many iterations, as
+ * after a flash, then delays only its own chunk instead of a whole static
+ * partition. step() returns once every pupil of the frame was stepped.
+ */
+class PupilScheduler {
+
+	class Pupil {
+	public:
+		PupilLifecycle * lifecycle;
+		PupilDynamicsModel * model;
+		float latency;
+	};
+
+	class Worker {
+	public:
+		PupilScheduler * scheduler;
+		int id;
+		pthread_t thread;
+		pthread_mutex_t lock;
+		std::deque<int> chunks;
+		WorkerStatistics statistics;
+	};
+
+	std::vector<Pupil> pupils;
+	std::vector<float> diameters;
+	std::vector<Worker *> workers;
+
+	int chunkSize;
+	bool workStealing;
+
+	// current frame
+	int frameChunkSize;
+	float time;
+	const float * intensities;
+	long frame;
+	int running;
+	bool stopping;
+	double frameSeconds;
+
+	pthread_mutex_t frameLock;
+	pthread_cond_t frameStarted;
+	pthread_cond_t frameFinished;
+
+public:
+	/**
+	 * threads: number of workers, all the online cores when 0.
+	 * _chunkSize: pupils per chunk, see defaultChunkSize when 0.
+	 */
+	PupilScheduler(int threads = 0, int _chunkSize = 0) {
+		if (threads <= 0) threads = std::max(1, (int) sysconf(_SC_NPROCESSORS_ONLN));
+
+		chunkSize = _chunkSize;
+		workStealing = true;
+		frameChunkSize = 1;
+		time = 0;
+		intensities = NULL;
+		frame = 0;
+		running = 0;
+		stopping = false;
+		frameSeconds = 0;
+
+		pthread_mutex_init(&frameLock, NULL);
+		pthread_cond_init(&frameStarted, NULL);
+		pthread_cond_init(&frameFinished, NULL);
+
+		for (int i=0; i<threads; i++) {
+			Worker * worker = new Worker();
+			worker->scheduler = this;
+			worker->id = i;
+			pthread_mutex_init(&worker->lock, NULL);
+			workers.push_back(worker);
+		}
+		for (int i=0; i<threads; i++) {
+			pthread_create(&workers[i]->thread, NULL, run, workers[i]);
+		}
+	}
+
+	virtual ~PupilScheduler() {
+		pthread_mutex_lock(&frameLock);
+		stopping = true;
+		pthread_cond_broadcast(&frameStarted);
+		pthread_mutex_unlock(&frameLock);
+
+		for (unsigned int i=0; i<workers.size(); i++) {
+			pthread_join(workers[i]->thread, NULL);
+			pthread_mutex_destroy(&workers[i]->lock);
+			delete workers[i];
+		}
+
+		pthread_cond_destroy(&frameFinished);
+		pthread_cond_destroy(&frameStarted);
+		pthread_mutex_destroy(&frameLock);
+	}
+
+	void add(PupilLifecycle * lifecycle) {
+		Pupil pupil = { lifecycle, NULL, 0 };
+		pupils.push_back(pupil);
+		diameters.push_back(0);
+	}
+
+	/** latency in milliseconds */
+	void add(PupilDynamicsModel * model, float latency) {
+		Pupil pupil = { NULL, model, latency };
+		pupils.push_back(pupil);
+		diameters.push_back(0);
+	}
+
+	int size() const {
+		return pupils.size();
+	}
+
+	int getWorkers() const {
+		return workers.size();
+	}
+
+	/** Without work stealing each worker only steps its own chunks. */
+	void setWorkStealing(bool v) {
+		workStealing = v;
+	}
+
+	bool isWorkStealing() const {
+		return workStealing;
+	}
+
+	/**
+	 * Enough pupils to fill half of the L2 cache with their histories, and
+	 * at least four chunks per worker to balance.
+	 */
+	int defaultChunkSize() const {
+		long cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
+		if (cache <= 0) cache = 256 * 1024;
+
+		// the 1000 pulses of history kept by each delay model
+		int size = std::max(1, (int) (cache / 2 / (1000 * sizeof(PupilSample))));
+		int balanced = std::max(1, (int) pupils.size() / (4 * (int) workers.size()));
+		return std::min(size, balanced);
+	}
+
+	int getChunkSize() const {
+		return chunkSize > 0 ? chunkSize : defaultChunkSize();
+	}
+
+	/**
+	 * Steps every pupil to time (milliseconds), pupil i receiving
+	 * stepIntensities[i]: blondels for lifecycles, the model's own unit
+	 * otherwise.
+	 */
+	void step(float _time, const float * stepIntensities) {
+		int size = getChunkSize();
+		int chunks = (pupils.size() + size - 1) / size;
+		int perWorker = (chunks + workers.size() - 1) / workers.size();
+
+		for (unsigned int w=0; w<workers.size(); w++) {
+			Worker * worker = workers[w];
+			worker->statistics.clear();
+			worker->chunks.clear();
+			for (int c = w * perWorker; c < std::min(chunks, (int) (w+1) * perWorker); c++) {
+				worker->chunks.push_back(c);
+			}
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		pthread_mutex_lock(&frameLock);
+		time = _time;
+		intensities = stepIntensities;
+		frameChunkSize = size;
+		running = workers.size();
+		frame++;
+		pthread_cond_broadcast(&frameStarted);
+		while (running > 0) {
+			pthread_cond_wait(&frameFinished, &frameLock);
+		}
+		pthread_mutex_unlock(&frameLock);
+
+		frameSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/** Pupil diameters in mm after the last frame */
+	const std::vector<float> & getDiameters() const {
+		return diameters;
+	}
+
+	float getDiameter(int pupil) const {
+		return diameters[pupil];
+	}
+
+	/** Wall time of the last frame */
+	double getFrameSeconds() const {
+		return frameSeconds;
+	}
+
+	const WorkerStatistics & getWorkerStatistics(int worker) const {
+		return workers[worker]->statistics;
+	}
+
+	/** Fraction of the last frame the worker spent stepping pupils */
+	double getUtilization(int worker) const {
+		return frameSeconds > 0 ? workers[worker]->statistics.busySeconds / frameSeconds : 0;
+	}
+
+private:
+	static void * run(void * argument) {
+		Worker * worker = (Worker *) argument;
+		PupilScheduler * scheduler = worker->scheduler;
+		long frame = 0;
+
+		while (true) {
+			pthread_mutex_lock(&scheduler->frameLock);
+			while (scheduler->frame == frame && !scheduler->stopping) {
+				pthread_cond_wait(&scheduler->frameStarted, &scheduler->frameLock);
+			}
+			if (scheduler->stopping) {
+				pthread_mutex_unlock(&scheduler->frameLock);
+				return NULL;
+			}
+			frame = scheduler->frame;
+			pthread_mutex_unlock(&scheduler->frameLock);
+
+			scheduler->work(worker);
+
+			pthread_mutex_lock(&scheduler->frameLock);
+			scheduler->running--;
+			if (scheduler->running == 0) pthread_cond_signal(&scheduler->frameFinished);
+			pthread_mutex_unlock(&scheduler->frameLock);
+		}
+	}
+
+	void work(Worker * worker) {
+		int chunk;
+		bool stolen;
+		while (nextChunk(worker, chunk, stolen)) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			stepChunk(chunk);
+			worker->statistics.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			worker->statistics.chunks++;
+			if (stolen) worker->statistics.stolen++;
+		}
+	}
+
+	/** Own chunks from the back, then other workers' from the front */
+	bool nextChunk(Worker * worker, int & chunk, bool & stolen) {
+		stolen = false;
+		if (popChunk(worker, false, chunk)) return true;
+		if (!workStealing) return false;
+
+		stolen = true;
+		for (unsigned int i=1; i<workers.size(); i++) {
+			Worker * victim = workers[(worker->id + i) % workers.size()];
+			if (popChunk(victim, true, chunk)) return true;
+		}
+		return false;
+	}
+
+	bool popChunk(Worker * worker, bool front, int & chunk) {
+		pthread_mutex_lock(&worker->lock);
+		bool found = !worker->chunks.empty();
+		if (found) {
+			if (front) {
+				chunk = worker->chunks.front();
+				worker->chunks.pop_front();
+			} else {
+				chunk = worker->chunks.back();
+				worker->chunks.pop_back();
+			}
+		}
+		pthread_mutex_unlock(&worker->lock);
+		return found;
+	}
+
+	void stepChunk(int chunk) {
+		int end = std::min((int) pupils.size(), (chunk + 1) * frameChunkSize);
+		for (int p = chunk * frameChunkSize; p < end; p++) {
+			Pupil & pupil = pupils[p];
+			if (pupil.lifecycle != NULL)
+				diameters[p] = pupil.lifecycle->getDiameter(time, intensities[p]);
+			else
+				diameters[p] = pupil.model->pupilDiameterAt(intensities[p], pupil.latency, time);
+		}
+	}
+};
+
+#endif /*PUPILSCHEDULER_H_*/
@@ -0,0 +1,354 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PUPILTRACE_H_
+#define PUPILTRACE_H_
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Binary trace of a simulation run: one sample per model step.
+ *
+ * The file is a 64 byte PupilTraceHeader followed by blocks of
+ * blockSamples samples. Each block is a 64 byte PupilTraceBlockHeader
+ * followed by one column per PupilTraceColumn, blockSamples values of 4
+ * bytes each, in native byte order. The last block is padded to the full
+ * size, so block b and its columns are at fixed offsets and every column
+ * starts 64 byte aligned.
+ */
+enum PupilTraceColumn {
+	TRACE_TIME,			// ms, float
+	TRACE_INTENSITY,	// in the unit of the model, float
+	TRACE_AREA,			// mm2, float
+	TRACE_DIAMETER,		// mm, float
+	TRACE_LATENCY,		// ms, float
+	TRACE_ITERATIONS,	// solver iterations of the step, int32
+	TRACE_COLUMNS
+};
+
+class PupilTraceHeader {
+public:
+	static constexpr const char * MAGIC = "PLRTRACE";
+	static const uint32_t VERSION = 1;
+
+	char magic[8];
+	uint32_t version;
+	uint32_t columns;
+	uint32_t blockSamples;
+	uint32_t reserved;
+	uint64_t samples;		// written when the trace is closed
+	char padding[32];
+};
+
+class PupilTraceBlockHeader {
+public:
+	uint32_t samples;
+	char padding[60];
+};
+
+static_assert(sizeof(PupilTraceHeader) == 64, "trace header must take 64 bytes");
+static_assert(sizeof(PupilTraceBlockHeader) == 64, "block header must take 64 bytes");
+
+/** One sample of a trace, held back by PupilTraceWriter::hold */
+class PupilTraceSample {
+public:
+	float time;
+	float intensity;
+	float area;
+	float diameter;
+	float latency;
+	int32_t iterations;
+};
+
+/**
+ * Appends samples to a trace file. Samples go straight into the columns of
+ * the current block, which is written once full. A block that cannot be
+ * written makes close() fail.
+ *
+ * Samples appended after hold() are kept aside until commit() appends them
+ * or discard() drops them, so a caller can take back the steps it retries.
+ */
+class PupilTraceWriter {
+	int file;
+	bool failed;
+	bool holding;
+	std::vector<PupilTraceSample> held;
+	uint32_t blockSamples;
+	uint32_t used;
+	uint64_t samples;
+	std::vector<char> block;
+
+public:
+	/** blockSamples is rounded up to a multiple of 16 */
+	PupilTraceWriter(uint32_t _blockSamples = 4096) :
+		file(-1), failed(false), holding(false), blockSamples((std::max(_blockSamples, 1u) + 15) / 16 * 16), used(0), samples(0),
+		block(sizeof(PupilTraceBlockHeader) + TRACE_COLUMNS * blockSamples * sizeof(float)) {
+		held.reserve(4);
+	}
+
+	virtual ~PupilTraceWriter() {
+		close();
+	}
+
+	PupilTraceWriter(const PupilTraceWriter &) = delete;
+	PupilTraceWriter & operator=(const PupilTraceWriter &) = delete;
+
+	/** Returns false, with errno set, if the file cannot be written */
+	bool open(const char * path) {
+		close();
+		file = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (file < 0) return false;
+
+		failed = false;
+		holding = false;
+		held.clear();
+		used = 0;
+		samples = 0;
+		return writeHeader();
+	}
+
+	bool isOpen() const {
+		return file >= 0;
+	}
+
+	void append(float time, float intensity, float area, float diameter, float latency, int32_t iterations) {
+		if (holding) {
+			PupilTraceSample sample = {time, intensity, area, diameter, latency, iterations};
+			held.push_back(sample);
+			return;
+		}
+
+		column(TRACE_TIME)[used] = time;
+		column(TRACE_INTENSITY)[used] = intensity;
+		column(TRACE_AREA)[used] = area;
+		column(TRACE_DIAMETER)[used] = diameter;
+		column(TRACE_LATENCY)[used] = latency;
+		memcpy(column(TRACE_ITERATIONS) + used, &iterations, sizeof(int32_t));
+
+		used++;
+		samples++;
+		if (used == blockSamples && !writeBlock()) failed = true;
+	}
+
+	/** Keeps the next samples aside, see commit() and discard() */
+	void hold() {
+		holding = true;
+	}
+
+	/** Appends the samples held so far, and stops holding */
+	void commit() {
+		holding = false;
+		for (size_t i=0; i<held.size(); i++) {
+			append(held[i].time, held[i].intensity, held[i].area, held[i].diameter, held[i].latency, held[i].iterations);
+		}
+		held.clear();
+	}
+
+	/** Drops the samples held so far, and keeps holding */
+	void discard() {
+		held.clear();
+	}
+
+	/** Samples appended, not counting the held ones */
+	uint64_t size() const {
+		return samples;
+	}
+
+	/**
+	 * Writes the last block and the sample count. Returns false if any
+	 * block could not be written.
+	 */
+	bool close() {
+		if (file < 0) return true;
+
+		commit();
+		bool ok = !failed && (used == 0 || writeBlock());
+		ok = writeHeader() && ok;
+		ok = ::close(file) == 0 && ok;
+		file = -1;
+		return ok;
+	}
+
+private:
+	float * column(int c) {
+		return (float *) (&block[0] + sizeof(PupilTraceBlockHeader)) + (size_t) c * blockSamples;
+	}
+
+	bool writeHeader() {
+		PupilTraceHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, PupilTraceHeader::MAGIC, 8);
+		header.version = PupilTraceHeader::VERSION;
+		header.columns = TRACE_COLUMNS;
+		header.blockSamples = blockSamples;
+		header.samples = samples;
+		return pwrite(file, &header, sizeof(header), 0) == sizeof(header);
+	}
+
+	bool writeBlock() {
+		PupilTraceBlockHeader * header = (PupilTraceBlockHeader *) &block[0];
+		memset(header, 0, sizeof(PupilTraceBlockHeader));
+		header->samples = used;
+
+		off_t offset = sizeof(PupilTraceHeader) + (off_t) ((samples - used) / blockSamples) * block.size();
+		size_t written = 0;
+		while (written < block.size()) {
+			ssize_t n = pwrite(file, &block[written], block.size() - written, offset + written);
+			if (n <= 0) break;
+			written += n;
+		}
+		used = 0;
+		return written == block.size();
+	}
+};
+
+/**
+ * Read-only memory map of a trace. Columns are read in place:
+ *
+ *   for (int b=0; b<reader.blocks(); b++) {
+ *       const float * diameters = reader.column(b, TRACE_DIAMETER);
+ *       for (uint32_t i=0; i<reader.blockSize(b); i++) ... diameters[i] ...
+ *   }
+ */
+class PupilTraceReader {
+	int file;
+	const char * data;
+	size_t length;
+	const PupilTraceHeader * header;
+	size_t blockBytes;
+	int blockCount;
+
+public:
+	PupilTraceReader() : file(-1), data(NULL), length(0), header(NULL), blockBytes(0), blockCount(0) {}
+
+	virtual ~PupilTraceReader() {
+		close();
+	}
+
+	PupilTraceReader(const PupilTraceReader &) = delete;
+	PupilTraceReader & operator=(const PupilTraceReader &) = delete;
+
+	/**
+	 * Returns false if the file cannot be mapped or is not a trace of this
+	 * version, or if a block or the header claims more samples than the
+	 * blocks in the file hold.
+	 */
+	bool open(const char * path) {
+		close();
+
+		file = ::open(path, O_RDONLY);
+		if (file < 0) return false;
+
+		struct stat status;
+		if (fstat(file, &status) != 0 || status.st_size < (off_t) sizeof(PupilTraceHeader)) {
+			close();
+			return false;
+		}
+
+		length = status.st_size;
+		void * mapped = mmap(NULL, length, PROT_READ, MAP_SHARED, file, 0);
+		if (mapped == MAP_FAILED) {
+			close();
+			return false;
+		}
+		data = (const char *) mapped;
+		madvise(mapped, length, MADV_SEQUENTIAL);
+
+		header = (const PupilTraceHeader *) data;
+		if (memcmp(header->magic, PupilTraceHeader::MAGIC, 8) != 0
+		    || header->version != PupilTraceHeader::VERSION
+		    || header->columns != TRACE_COLUMNS
+		    || header->blockSamples == 0 || header->blockSamples % 16 != 0) {
+			close();
+			return false;
+		}
+
+		blockBytes = sizeof(PupilTraceBlockHeader) + (size_t) TRACE_COLUMNS * header->blockSamples * sizeof(float);
+		blockCount = (length - sizeof(PupilTraceHeader)) / blockBytes;
+
+		uint64_t total = 0;
+		for (int b=0; b<blockCount; b++) {
+			if (blockSize(b) > header->blockSamples) {
+				close();
+				return false;
+			}
+			total += blockSize(b);
+		}
+		if (header->samples > total) {
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close() {
+		if (data != NULL) munmap((void *) data, length);
+		if (file >= 0) ::close(file);
+		file = -1;
+		data = NULL;
+		length = 0;
+		header = NULL;
+		blockCount = 0;
+	}
+
+	uint32_t version() const {
+		return header->version;
+	}
+
+	/** Samples in the file, counting the blocks of a trace never closed */
+	uint64_t size() const {
+		if (header->samples > 0) return header->samples;
+		uint64_t total = 0;
+		for (int b=0; b<blockCount; b++) total += blockSize(b);
+		return total;
+	}
+
+	int blocks() const {
+		return blockCount;
+	}
+
+	uint32_t blockSamples() const {
+		return header->blockSamples;
+	}
+
+	/** Samples in block b */
+	uint32_t blockSize(int b) const {
+		return ((const PupilTraceBlockHeader *) blockAt(b))->samples;
+	}
+
+	const float * column(int b, PupilTraceColumn c) const {
+		return (const float *) (blockAt(b) + sizeof(PupilTraceBlockHeader)) + (size_t) c * header->blockSamples;
+	}
+
+	const int32_t * iterations(int b) const {
+		return (const int32_t *) column(b, TRACE_ITERATIONS);
+	}
+
+private:
+	const char * blockAt(int b) const {
+		return data + sizeof(PupilTraceHeader) + b * blockBytes;
+	}
+};
+
+#endif /*PUPILTRACE_H_*/
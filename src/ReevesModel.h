@@ -34,6 +34,23 @@ public:
 	virtual float pupilDiameterAt(float lightIntensity) {
 		return pupilDiameterWithBlondel(lightIntensity);
 	}
+
+	/**
+	 * Intensities in Blondels
+	 */
+	virtual void pupilDiameterAt(const float * intensities, float * diameters, size_t n) {
+		size_t i = 0;
+#ifdef PLR_SIMD
+		for (; i + FLOAT_PACK_WIDTH <= n; i += FLOAT_PACK_WIDTH) {
+			FloatPack intensity = FloatPack::load(intensities + i);
+			FloatPack diameter = FloatPack(4.90f) - FloatPack(3.20f)*tanh(FloatPack(0.471f)*(log10(intensity)-FloatPack(1.30f)));
+			diameter.store(diameters + i);
+		}
+#endif
+		for (; i < n; i++) {
+			diameters[i] = ReevesModel::pupilDiameterWithBlondel(intensities[i]);
+		}
+	}
 	
 	/**
 	 * Intensity in Blondel
@@ -0,0 +1,102 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ROOTFINDER_H_
+#define ROOTFINDER_H_
+
+/**
+ * Solvers available to the delay models for their implicit equations.
+ */
+enum SolverType {
+	STEP_HALVING_SOLVER,	// original search: walks and halves the step on every overshoot
+	NEWTON_SOLVER			// safeguarded Newton, see RootFinder
+};
+
+/**
+ * Outcome of RootFinder::solve
+ */
+enum RootStatus {
+	ROOT_FOUND,		// |f(x)| within the tolerance
+	ROOT_CLAMPED,	// no root inside the interval, x is next to the end it ran into
+	ROOT_FAILED,	// f is not a number
+	ROOT_NOT_CONVERGED	// the bracket collapsed or the iterations ran out above the tolerance
+};
+
+/**
+ * Safeguarded Newton-Raphson for monotone functions, shared by the delay
+ * models to solve their equations for the next diameter or area.
+ *
+ * The root is kept inside a bracket that shrinks at every evaluation. A
+ * Newton step is taken when it lands inside the bracket, otherwise the
+ * bracket is bisected, so the search always converges.
+ *
+ * Function must provide
+ *   void evaluate(double x, double & value, double & derivative)
+ */
+class RootFinder {
+public:
+	/**
+	 * Finds x in (low, high) with |f(x)| <= tolerance starting from guess.
+	 * increasing tells whether f grows with x. Iterations counts the
+	 * evaluations of f.
+	 */
+	template <class Function>
+	static RootStatus solve(Function & f, double low, double high, bool increasing,
+	                        double guess, double tolerance, double & x, int & iterations) {
+		double value, derivative;
+		double width = (high - low) * 1.0e-7;
+
+		// a sign change is only known once both ends have moved
+		bool lowMoved = false;
+		bool highMoved = false;
+
+		x = guess;
+		iterations = 0;
+
+		while (iterations < 64) {
+			f.evaluate(x, value, derivative);
+			iterations++;
+
+			// not a number: only possible when the model state is invalid.
+			if (value != value) return ROOT_FAILED;
+
+			if (fabs(value) <= tolerance) return ROOT_FOUND;
+
+			// shrink the bracket towards the root
+			if ((value > 0) == increasing) {
+				high = x;
+				highMoved = true;
+			} else {
+				low = x;
+				lowMoved = true;
+			}
+
+			if (high - low <= width) break;
+
+			double newton = x - value / derivative;
+
+			if (newton > low && newton < high)
+				x = newton;
+			else
+				x = 0.5 * (low + high);
+		}
+
+		return lowMoved && highMoved ? ROOT_NOT_CONVERGED : ROOT_CLAMPED;
+	}
+};
+
+#endif /*ROOTFINDER_H_*/
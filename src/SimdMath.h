@@ -0,0 +1,293 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIMDMATH_H_
+#define SIMDMATH_H_
+
+/**
+ * Packs of floats for the batch solvers.
+ *
+ * FloatPack holds FLOAT_PACK_WIDTH lanes: 8 with AVX2, 4 with SSE2. When
+ * neither is available, or PLR_NO_SIMD is defined, PLR_SIMD is left
+ * undefined and the batch code falls back to the scalar models.
+ *
+ * Comparisons return masks with all bits of a lane set when true.
+ */
+#if !defined(PLR_NO_SIMD) && defined(__AVX2__)
+
+#include <immintrin.h>
+#define PLR_SIMD 1
+
+const int FLOAT_PACK_WIDTH = 8;
+
+class FloatPack {
+public:
+	__m256 v;
+
+	FloatPack() {}
+	FloatPack(__m256 _v) : v(_v) {}
+	FloatPack(float value) : v(_mm256_set1_ps(value)) {}
+
+	static FloatPack load(const float * values) { return _mm256_loadu_ps(values); }
+	void store(float * values) const { _mm256_storeu_ps(values, v); }
+};
+
+inline FloatPack operator + (FloatPack a, FloatPack b) { return _mm256_add_ps(a.v, b.v); }
+inline FloatPack operator - (FloatPack a, FloatPack b) { return _mm256_sub_ps(a.v, b.v); }
+inline FloatPack operator * (FloatPack a, FloatPack b) { return _mm256_mul_ps(a.v, b.v); }
+inline FloatPack operator / (FloatPack a, FloatPack b) { return _mm256_div_ps(a.v, b.v); }
+inline FloatPack operator & (FloatPack a, FloatPack b) { return _mm256_and_ps(a.v, b.v); }
+inline FloatPack operator | (FloatPack a, FloatPack b) { return _mm256_or_ps(a.v, b.v); }
+
+inline FloatPack operator < (FloatPack a, FloatPack b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline FloatPack operator > (FloatPack a, FloatPack b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline FloatPack operator <= (FloatPack a, FloatPack b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+
+/** a & ~mask */
+inline FloatPack andNot(FloatPack mask, FloatPack a) { return _mm256_andnot_ps(mask.v, a.v); }
+/** mask ? a : b, lane by lane */
+inline FloatPack select(FloatPack mask, FloatPack a, FloatPack b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+inline bool any(FloatPack mask) { return _mm256_movemask_ps(mask.v) != 0; }
+inline int countLanes(FloatPack mask) { return __builtin_popcount(_mm256_movemask_ps(mask.v)); }
+inline FloatPack min(FloatPack a, FloatPack b) { return _mm256_min_ps(a.v, b.v); }
+inline FloatPack max(FloatPack a, FloatPack b) { return _mm256_max_ps(a.v, b.v); }
+
+/** Unbiased binary exponent of each lane, as floats. */
+inline FloatPack exponentOf(FloatPack a) {
+	__m256i bits = _mm256_srli_epi32(_mm256_castps_si256(a.v), 23);
+	return _mm256_cvtepi32_ps(_mm256_sub_epi32(bits, _mm256_set1_epi32(127)));
+}
+
+/** Mantissa of each lane scaled to [0.5, 1). */
+inline FloatPack mantissaOf(FloatPack a) {
+	__m256i bits = _mm256_and_si256(_mm256_castps_si256(a.v), _mm256_set1_epi32(0x807fffff));
+	return _mm256_castsi256_ps(_mm256_or_si256(bits, _mm256_set1_epi32(0x3f000000)));
+}
+
+/** Each lane rounded to the nearest integer. */
+inline FloatPack roundToNearest(FloatPack a) {
+	return _mm256_cvtepi32_ps(_mm256_cvtps_epi32(a.v));
+}
+
+/** a * 2^n for integral n in [-126, 127]. */
+inline FloatPack scaleByPowerOfTwo(FloatPack a, FloatPack n) {
+	__m256i exponent = _mm256_slli_epi32(_mm256_cvtps_epi32(n.v), 23);
+	return _mm256_castsi256_ps(_mm256_add_epi32(_mm256_castps_si256(a.v), exponent));
+}
+
+#elif !defined(PLR_NO_SIMD) && defined(__SSE2__)
+
+#include <emmintrin.h>
+#define PLR_SIMD 1
+
+const int FLOAT_PACK_WIDTH = 4;
+
+class FloatPack {
+public:
+	__m128 v;
+
+	FloatPack() {}
+	FloatPack(__m128 _v) : v(_v) {}
+	FloatPack(float value) : v(_mm_set1_ps(value)) {}
+
+	static FloatPack load(const float * values) { return _mm_loadu_ps(values); }
+	void store(float * values) const { _mm_storeu_ps(values, v); }
+};
+
+inline FloatPack operator + (FloatPack a, FloatPack b) { return _mm_add_ps(a.v, b.v); }
+inline FloatPack operator - (FloatPack a, FloatPack b) { return _mm_sub_ps(a.v, b.v); }
+inline FloatPack operator * (FloatPack a, FloatPack b) { return _mm_mul_ps(a.v, b.v); }
+inline FloatPack operator / (FloatPack a, FloatPack b) { return _mm_div_ps(a.v, b.v); }
+inline FloatPack operator & (FloatPack a, FloatPack b) { return _mm_and_ps(a.v, b.v); }
+inline FloatPack operator | (FloatPack a, FloatPack b) { return _mm_or_ps(a.v, b.v); }
+
+inline FloatPack operator < (FloatPack a, FloatPack b) { return _mm_cmplt_ps(a.v, b.v); }
+inline FloatPack operator > (FloatPack a, FloatPack b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline FloatPack operator <= (FloatPack a, FloatPack b) { return _mm_cmple_ps(a.v, b.v); }
+
+/** a & ~mask */
+inline FloatPack andNot(FloatPack mask, FloatPack a) { return _mm_andnot_ps(mask.v, a.v); }
+/** mask ? a : b, lane by lane */
+inline FloatPack select(FloatPack mask, FloatPack a, FloatPack b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+inline bool any(FloatPack mask) { return _mm_movemask_ps(mask.v) != 0; }
+inline int countLanes(FloatPack mask) { return __builtin_popcount(_mm_movemask_ps(mask.v)); }
+inline FloatPack min(FloatPack a, FloatPack b) { return _mm_min_ps(a.v, b.v); }
+inline FloatPack max(FloatPack a, FloatPack b) { return _mm_max_ps(a.v, b.v); }
+
+/** Unbiased binary exponent of each lane, as floats. */
+inline FloatPack exponentOf(FloatPack a) {
+	__m128i bits = _mm_srli_epi32(_mm_castps_si128(a.v), 23);
+	return _mm_cvtepi32_ps(_mm_sub_epi32(bits, _mm_set1_epi32(127)));
+}
+
+/** Mantissa of each lane scaled to [0.5, 1). */
+inline FloatPack mantissaOf(FloatPack a) {
+	__m128i bits = _mm_and_si128(_mm_castps_si128(a.v), _mm_set1_epi32(0x807fffff));
+	return _mm_castsi128_ps(_mm_or_si128(bits, _mm_set1_epi32(0x3f000000)));
+}
+
+/** Each lane rounded to the nearest integer. */
+inline FloatPack roundToNearest(FloatPack a) {
+	return _mm_cvtepi32_ps(_mm_cvtps_epi32(a.v));
+}
+
+/** a * 2^n for integral n in [-126, 127]. */
+inline FloatPack scaleByPowerOfTwo(FloatPack a, FloatPack n) {
+	__m128i exponent = _mm_slli_epi32(_mm_cvtps_epi32(n.v), 23);
+	return _mm_castsi128_ps(_mm_add_epi32(_mm_castps_si128(a.v), exponent));
+}
+
+#endif
+
+#ifdef PLR_SIMD
+
+inline FloatPack abs(FloatPack a) {
+	return andNot(FloatPack(-0.0f), a);
+}
+
+/** Cephes logf series of a reduced mantissa x, see log */
+inline FloatPack logPolynomial(FloatPack x) {
+	FloatPack y = FloatPack(7.0376836292e-2f);
+	y = y * x + FloatPack(-1.1514610310e-1f);
+	y = y * x + FloatPack(1.1676998740e-1f);
+	y = y * x + FloatPack(-1.2420140846e-1f);
+	y = y * x + FloatPack(1.4249322787e-1f);
+	y = y * x + FloatPack(-1.6668057665e-1f);
+	y = y * x + FloatPack(2.0000714765e-1f);
+	y = y * x + FloatPack(-2.4999993993e-1f);
+	y = y * x + FloatPack(3.3333331174e-1f);
+	return y;
+}
+
+/**
+ * Natural logarithm.
+ *
+ * Cephes logf polynomial: relative error below 1.2e-7 for normal positive
+ * inputs. Zero gives -inf and negative or NaN lanes give NaN, as std::log.
+ */
+inline FloatPack log(FloatPack x) {
+	// false for negative and NaN lanes
+	FloatPack valid = FloatPack(0.0f) <= x;
+	FloatPack zero = x <= FloatPack(0.0f);
+
+	x = max(x, FloatPack(1.17549435e-38f));
+	FloatPack e = exponentOf(x) + FloatPack(1.0f);
+	x = mantissaOf(x);
+
+	// keep the mantissa in [sqrt(0.5), sqrt(2))
+	FloatPack small = x < FloatPack(0.707106781186547524f);
+	e = e - (small & FloatPack(1.0f));
+	x = x + (small & x) - FloatPack(1.0f);
+
+	FloatPack z = x * x;
+	FloatPack y = logPolynomial(x) * x * z;
+
+	y = y + e * FloatPack(-2.12194440e-4f);
+	y = y - z * FloatPack(0.5f);
+	x = x + y + e * FloatPack(0.693359375f);
+
+	x = select(zero, FloatPack(-INFINITY), x);
+	return select(valid, x, FloatPack(NAN));
+}
+
+/**
+ * Inverse hyperbolic tangent as 0.5 * (log(1+x) - log(1-x)), the same
+ * formula used by the models. Inherits the error of log: absolute error
+ * below 2.5e-7 * max(|log(1+x)|, |log(1-x)|).
+ */
+inline FloatPack arcTanH(FloatPack x) {
+	FloatPack one(1.0f);
+	return FloatPack(0.5f) * (log(one + x) - log(one - x));
+}
+
+/** Base 10 logarithm, log(x) / log(10). */
+inline FloatPack log10(FloatPack x) {
+	return log(x) * FloatPack(0.434294481903251828f);
+}
+
+/**
+ * Base 10 logarithm as high + low, for callers that finish in double:
+ * high is e log10(2), exact for the binary exponent e, and low the rest.
+ * The sum is within 3e-8 of log10(x) for normal positive lanes, where
+ * log10 rounds to float. Other lanes give log10(x) in high and 0 in low.
+ */
+inline void log10Split(FloatPack x, FloatPack & high, FloatPack & low) {
+	FloatPack normal = FloatPack(1.17549435e-38f) <= x;
+
+	FloatPack m = max(x, FloatPack(1.17549435e-38f));
+	FloatPack e = exponentOf(m) + FloatPack(1.0f);
+	m = mantissaOf(m);
+
+	// keep the mantissa in [sqrt(0.5), sqrt(2)), as log
+	FloatPack small = m < FloatPack(0.707106781186547524f);
+	e = e - (small & FloatPack(1.0f));
+	m = m + (small & m) - FloatPack(1.0f);
+
+	FloatPack z = m * m;
+	FloatPack logOfMantissa = m + (logPolynomial(m) * m * z - z * FloatPack(0.5f));
+
+	// log10(2) = 0.301025390625 (11 bits) + 4.605038981e-6
+	high = e * FloatPack(0.301025390625f);
+	low = e * FloatPack(4.605038981e-6f) + logOfMantissa * FloatPack(0.434294481903251828f);
+
+	if (countLanes(normal) < FLOAT_PACK_WIDTH) {
+		high = select(normal, high, log10(x));
+		low = normal & low;
+	}
+}
+
+/**
+ * Exponential.
+ *
+ * Cephes expf polynomial: relative error below 2e-7. Lanes are clamped to
+ * [-87.3, 88.7], so the result is always a normal number.
+ */
+inline FloatPack exp(FloatPack x) {
+	x = min(max(x, FloatPack(-87.3f)), FloatPack(88.7f));
+
+	// x = n * log(2) + r, |r| <= log(2) / 2
+	FloatPack n = roundToNearest(x * FloatPack(1.44269504088896341f));
+	x = x - n * FloatPack(0.693359375f) - n * FloatPack(-2.12194440e-4f);
+
+	FloatPack y = FloatPack(1.9875691500e-4f);
+	y = y * x + FloatPack(1.3981999507e-3f);
+	y = y * x + FloatPack(8.3334519073e-3f);
+	y = y * x + FloatPack(4.1665795894e-2f);
+	y = y * x + FloatPack(1.6666665459e-1f);
+	y = y * x + FloatPack(5.0000001201e-1f);
+	y = y * x * x + x + FloatPack(1.0f);
+
+	return scaleByPowerOfTwo(y, n);
+}
+
+/** 10^x */
+inline FloatPack exp10(FloatPack x) {
+	return exp(x * FloatPack(2.30258509299404568f));
+}
+
+/**
+ * Hyperbolic tangent as 1 - 2 / (exp(2x) + 1). Absolute error below
+ * 3e-7, which is what the models need: they scale it by a few mm.
+ */
+inline FloatPack tanh(FloatPack x) {
+	FloatPack one(1.0f);
+	return one - FloatPack(2.0f) / (exp(x + x) + one);
+}
+
+#endif
+
+#endif /*SIMDMATH_H_*/
@@ -0,0 +1,109 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STATICPUPILLIFECYCLE_H_
+#define STATICPUPILLIFECYCLE_H_
+
+/**
+ * PupilLifecycle with its models fixed at compile time.
+ *
+ * The models are held by value and called by their qualified names, so
+ * pupilDiameterAt and pupilLatencyAt are resolved at compile time and can
+ * be inlined in the stepping loop. Gives the same diameters as a
+ * PupilLifecycle set to the same models.
+ */
+template <class Dynamics, class Latency>
+class StaticPupilLifecycle {
+	Dynamics dynamics;
+	Latency latency;
+
+	// Frequency in cd/mm2, applied once their latency passed
+	StimulusQueue latencyFifo;
+
+	static constexpr const PupilModelInfo & info() {
+		return ModelRegistry::info(ModelTraits<Dynamics>::id);
+	}
+
+public:
+	/**
+	 * Delay models start dark adapted, with 10 s of history before time,
+	 * and see a 10 blondels stimulus at time, as in PupilLifecycle.
+	 */
+	StaticPupilLifecycle(const Dynamics & _dynamics, const Latency & _latency, float time = 0) :
+		StaticPupilLifecycle(_dynamics, _latency, time, TabulatedFunctions::DARK_BLONDELS, powf(10, 1)) {}
+
+	/** Starts adapted to, and lit by, ambient blondels */
+	StaticPupilLifecycle(const Dynamics & _dynamics, const Latency & _latency, float time, float ambient) :
+		StaticPupilLifecycle(_dynamics, _latency, time, ambient, ambient) {}
+
+	StaticPupilLifecycle(const Dynamics & _dynamics, const Latency & _latency, float time, float ambient, float stimulus) :
+		dynamics(_dynamics), latency(_latency) {
+		if (info().stateful) {
+			latencyFifo.intensity = ambient;
+			dynamics.Dynamics::setSteadyState(time, ambient);
+		}
+
+		setIntensity(stimulus, time);
+	}
+
+	PupilModelId getPupilModelId() const {
+		return ModelTraits<Dynamics>::id;
+	}
+
+	LatencyModelId getLatencyModelId() const {
+		return ModelTraits<Latency>::id;
+	}
+
+	Dynamics & getDynamics() {
+		return dynamics;
+	}
+
+	Latency & getLatency() {
+		return latency;
+	}
+
+	/**
+	 * Intensity in Cd/mm2
+	 */
+	void setIntensity(float _intensity, float time) {
+		latencyFifo.add(time + (int)latency.Latency::pupilLatencyAt(_intensity), _intensity);
+	}
+
+	/** Returns the pupil diameter in mm.
+	 */
+	float getDiameter(float time) {
+		latencyFifo.apply(time);
+		float intensity = latencyFifo.intensity;
+
+		if constexpr (info().stateful) {
+			float freshIntensity = latencyFifo.freshIntensity;
+			if constexpr (info().unit == IntensityUnit::LUMENS_PER_SQUARE_MM)
+				freshIntensity = Conversion::blondelToLumensSquareMillimeter(freshIntensity);
+			return dynamics.Dynamics::pupilDiameterAt(freshIntensity, latency.Latency::pupilLatencyAt(intensity), time);
+		} else {
+			// stateless models only depend on the intensity in effect
+			return dynamics.Dynamics::pupilDiameterAt(intensity);
+		}
+	}
+
+	float getDiameter(float time, float _intensity) {
+		setIntensity(_intensity, time);
+		return getDiameter(time);
+	}
+};
+
+#endif /*STATICPUPILLIFECYCLE_H_*/
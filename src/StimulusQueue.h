@@ -0,0 +1,87 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STIMULUSQUEUE_H_
+#define STIMULUSQUEUE_H_
+
+/**
+ * Light stimuli waiting for the latency of the pupil before they take
+ * effect.
+ *
+ * Onsets strictly increase along the queue: a stimulus set later with an
+ * earlier or equal onset always overrides the older one, so the older one
+ * is dropped. Stimuli are dropped again once applied, which makes both add
+ * and apply O(1) amortized.
+ */
+class StimulusQueue {
+	// x = onset time, y = intensity
+	HistoryFifo<Vector2f, 1024> pending;
+
+public:
+	// intensity in effect
+	float intensity;
+	// last intensity added, before its latency
+	float freshIntensity;
+
+	StimulusQueue() : intensity(0), freshIntensity(0) {}
+
+	void add(float onset, float stimulus) {
+		while (!pending.empty() && pending.last().x() >= onset) {
+			pending.removeLast();
+		}
+
+		// full: the oldest stimulus is applied early rather than lost
+		if (pending.size() == pending.capacity()) {
+			intensity = pending.first().y();
+			pending.removeFirst();
+		}
+
+		pending.add(Vector2f(onset, stimulus));
+		freshIntensity = stimulus;
+	}
+
+	/** Applies and drops the stimuli whose onset is before time */
+	void apply(float time) {
+		while (!pending.empty() && time > pending.first().x()) {
+			intensity = pending.first().y();
+			pending.removeFirst();
+		}
+	}
+
+	int size() const {
+		return pending.size();
+	}
+
+	void saveState(CheckpointWriter & out) const {
+		out.write(intensity);
+		out.write(freshIntensity);
+		out.writeHistory(pending);
+	}
+
+	bool restoreState(CheckpointReader & in) {
+		float stateIntensity, stateFreshIntensity;
+		in.read(stateIntensity);
+		in.read(stateFreshIntensity);
+		if (!in.ok() || !in.readHistory(pending)) return false;
+
+		intensity = stateIntensity;
+		freshIntensity = stateFreshIntensity;
+		return true;
+	}
+};
+
+#endif /*STIMULUSQUEUE_H_*/
@@ -0,0 +1,228 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STIMULUSTRACE_H_
+#define STIMULUSTRACE_H_
+
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Recorded luminances, read sample by sample from a memory mapped file.
+ *
+ * CSV traces have one "time,intensity" sample per line, time in
+ * milliseconds and intensity in blondels, separated by commas, semicolons,
+ * tabs or spaces. Lines that do not start with a number, as headers and
+ * # comments, are skipped.
+ *
+ * Binary traces start with the 8 bytes of BINARY_MAGIC followed by
+ * (time, intensity) pairs of native floats.
+ *
+ * The kernel pages the file in and out as it is read, so memory stays
+ * bounded whatever the length of the trace.
+ */
+class StimulusTrace {
+	int file;
+	const char * data;
+	size_t length;
+	const char * cursor;
+	bool binary;
+
+public:
+	static constexpr const char * BINARY_MAGIC = "PLRSTIM1";
+
+	StimulusTrace() : file(-1), data(NULL), length(0), cursor(NULL), binary(false) {}
+
+	~StimulusTrace() {
+		close();
+	}
+
+	StimulusTrace(const StimulusTrace &) = delete;
+	StimulusTrace & operator=(const StimulusTrace &) = delete;
+
+	/** Returns false, with errno set, if the file cannot be mapped */
+	bool open(const char * path) {
+		close();
+
+		file = ::open(path, O_RDONLY);
+		if (file < 0) return false;
+
+		struct stat status;
+		if (fstat(file, &status) != 0) {
+			close();
+			return false;
+		}
+
+		length = status.st_size;
+		if (length > 0) {
+			void * mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, file, 0);
+			if (mapped == MAP_FAILED) {
+				data = NULL;
+				close();
+				return false;
+			}
+			data = (const char *) mapped;
+			madvise(mapped, length, MADV_SEQUENTIAL);
+		}
+
+		binary = length >= 8 && memcmp(data, BINARY_MAGIC, 8) == 0;
+		cursor = binary ? data + 8 : data;
+		return true;
+	}
+
+	void close() {
+		if (data != NULL) munmap((void *) data, length);
+		if (file >= 0) ::close(file);
+		file = -1;
+		data = NULL;
+		length = 0;
+		cursor = NULL;
+	}
+
+	bool isBinary() const {
+		return binary;
+	}
+
+	/** Next sample, false at the end of the trace */
+	bool next(float & time, float & intensity) {
+		if (data == NULL) return false;
+		const char * end = data + length;
+
+		if (binary) {
+			if (end - cursor < (long) (2 * sizeof(float))) return false;
+			memcpy(&time, cursor, sizeof(float));
+			memcpy(&intensity, cursor + sizeof(float), sizeof(float));
+			cursor += 2 * sizeof(float);
+			return true;
+		}
+
+		while (cursor < end) {
+			const char * line = cursor;
+			const char * lineEnd = (const char *) memchr(line, '\n', end - line);
+			if (lineEnd == NULL) lineEnd = end;
+			cursor = lineEnd < end ? lineEnd + 1 : end;
+
+			while (line < lineEnd && (*line == ' ' || *line == '\t')) line++;
+			std::from_chars_result t = std::from_chars(line, lineEnd, time);
+			if (t.ec != std::errc()) continue;
+
+			line = t.ptr;
+			while (line < lineEnd && (*line == ',' || *line == ';' || *line == ' ' || *line == '\t')) line++;
+			std::from_chars_result i = std::from_chars(line, lineEnd, intensity);
+			if (i.ec != std::errc()) continue;
+
+			return true;
+		}
+		return false;
+	}
+};
+
+/**
+ * Pupil diameters written to a file descriptor through a fixed buffer, as
+ * "time,diameter" CSV lines or, in binary, BINARY_MAGIC followed by
+ * (time, diameter) pairs of native floats. Once a write fails, the rest
+ * of the data is dropped and flush() keeps returning false.
+ */
+class DiameterTraceWriter {
+	int file;
+	bool binary;
+	bool failed;
+	size_t used;
+	char buffer[64 * 1024];
+
+public:
+	static constexpr const char * BINARY_MAGIC = "PLRDIAM1";
+
+	DiameterTraceWriter(int _file, bool _binary) : file(_file), binary(_binary), failed(false), used(0) {
+		if (binary) append(BINARY_MAGIC, 8);
+		else append("time,diameter\n", 14);
+	}
+
+	~DiameterTraceWriter() {
+		flush();
+	}
+
+	DiameterTraceWriter(const DiameterTraceWriter &) = delete;
+	DiameterTraceWriter & operator=(const DiameterTraceWriter &) = delete;
+
+	/** time in milliseconds, diameter in mm */
+	void write(float time, float diameter) {
+		if (sizeof(buffer) - used < 64) flush();
+
+		if (binary) {
+			memcpy(buffer + used, &time, sizeof(float));
+			memcpy(buffer + used + sizeof(float), &diameter, sizeof(float));
+			used += 2 * sizeof(float);
+		} else {
+			char * end = buffer + sizeof(buffer);
+			char * position = std::to_chars(buffer + used, end, time).ptr;
+			*position++ = ',';
+			position = std::to_chars(position, end, diameter).ptr;
+			*position++ = '\n';
+			used = position - buffer;
+		}
+	}
+
+	/** Returns false if the file did not take all the data, now or before */
+	bool flush() {
+		size_t written = 0;
+		while (!failed && written < used) {
+			ssize_t n = ::write(file, buffer + written, used - written);
+			if (n <= 0) failed = true;
+			else written += n;
+		}
+		used = 0;
+		return !failed;
+	}
+
+private:
+	void append(const char * bytes, size_t size) {
+		memcpy(buffer + used, bytes, size);
+		used += size;
+	}
+};
+
+/**
+ * Streams a stimulus trace through a pupil and latency model pair, one
+ * PupilLifecycle step per sample. Delay models start adapted to the
+ * luminance of the first sample. Each step is also appended to
+ * traceWriter, if given. Returns the number of samples, or -1 if output
+ * could not be written.
+ */
+inline long replayStimulusTrace(StimulusTrace & trace, DiameterTraceWriter & output,
+                                PupilModelId pupilModel, LatencyModelId latencyModel,
+                                PupilTraceWriter * traceWriter = NULL) {
+	float time, intensity;
+	if (!trace.next(time, intensity)) return 0;
+
+	PupilLifecycle lifecycle(pupilModel, latencyModel, time, intensity);
+	lifecycle.getDynamics()->setTraceWriter(traceWriter);
+	long samples = 0;
+	do {
+		output.write(time, lifecycle.getDiameter(time, intensity));
+		samples++;
+	} while (trace.next(time, intensity));
+
+	if (!output.flush()) return -1;
+	return samples;
+}
+
+#endif /*STIMULUSTRACE_H_*/
@@ -0,0 +1,169 @@
+/** PupilDynamic - Complete model of the human iris.
+    Copyright (C) 2007 Vitor Fernando Pamplona (vitor@vitorpamplona.com)
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TABULATEDLATENCYMODEL_H_
+#define TABULATEDLATENCYMODEL_H_
+
+/**
+ * Latency model sampled into a table, so that the two latencies of every
+ * PupilLifecycle step cost no log10 or pow.
+ *
+ * The table is indexed by the bits of the intensity: the exponent and the
+ * first SEGMENT_BITS bits of the mantissa pick one of 32 segments per
+ * octave from FIRST_BLONDELS to LAST_BLONDELS, and the rest of the
+ * mantissa interpolates linearly inside it, which makes a piecewise linear
+ * log10. A table is 5 KB. Intensities out of the range, zero and NaN are
+ * passed to the wrapped model.
+ *
+ * LinkAndStarkModel also depends on the frequency. Tabulated up to a
+ * frequency, it keeps a table every FREQUENCY_STEP Hz and interpolates
+ * the latency between the two around its frequency as well.
+ */
+class TabulatedLatencyModel : public LatencyModel {
+public:
+	static const int SEGMENT_BITS = 5;
+	static const int OCTAVES = 40;
+	static const int SEGMENTS = OCTAVES << SEGMENT_BITS;
+
+	// 2^-20 and 2^20 blondels
+	static constexpr float FIRST_BLONDELS = 1.0f / (1 << 20);
+	static constexpr float LAST_BLONDELS = 1 << 20;
+
+	static constexpr float FREQUENCY_STEP = 0.5f;
+
+private:
+	static const int FRACTION_BITS = 23 - SEGMENT_BITS;
+	static const uint32_t FIRST_BITS = (uint32_t) (127 - 20) << 23;
+
+	LatencyModel * model;
+	// model, when tabulated over frequencies
+	LinkAndStarkModel * linkAndStark;
+
+	// SEGMENTS + 1 latencies for each frequency
+	std::vector<float> values;
+	int rows;
+
+	float frequency;
+	// first of the two tables around frequency and the weight of the
+	// second one; row is -1 out of the tabulated frequencies
+	int row;
+	float rowWeight;
+
+	static float intensityAt(uint32_t offset) {
+		uint32_t bits = FIRST_BITS + offset;
+		float intensity;
+		memcpy(&intensity, &bits, sizeof(intensity));
+		return intensity;
+	}
+
+	void sample(int r) {
+		for (int i=0; i<=SEGMENTS; i++) {
+			values[r * (SEGMENTS + 1) + i] = model->pupilLatencyAt(intensityAt((uint32_t) i << FRACTION_BITS));
+		}
+	}
+
+public:
+	/** Takes over model, tabulated as it is */
+	TabulatedLatencyModel(LatencyModel * _model) : LatencyModel(_model->getName()),
+		model(_model), linkAndStark(NULL), values(SEGMENTS + 1), rows(1), frequency(0), row(0), rowWeight(0) {
+		sample(0);
+	}
+
+	/** Takes over model, tabulated from 0 to maxFrequency Hz */
+	TabulatedLatencyModel(LinkAndStarkModel * _model, float maxFrequency) : LatencyModel(_model->getName()),
+		model(_model), linkAndStark(_model), rows(std::max(2, (int) ceilf(maxFrequency / FREQUENCY_STEP) + 1)),
+		frequency(0), row(0), rowWeight(0) {
+		values.resize(rows * (SEGMENTS + 1));
+		float current = _model->getFrequency();
+		for (int r=0; r<rows; r++) {
+			_model->setFrequency(r * FREQUENCY_STEP);
+			sample(r);
+		}
+		setFrequency(current);
+	}
+
+	TabulatedLatencyModel(const TabulatedLatencyModel &) = delete;
+	TabulatedLatencyModel & operator=(const TabulatedLatencyModel &) = delete;
+
+	virtual ~TabulatedLatencyModel() {
+		delete model;
+	}
+
+	LatencyModel * getModel() {
+		return model;
+	}
+
+	/** Frequency in Hertz (Hz) of a Link and Stark model tabulated over frequencies */
+	void setFrequency(float _frequency) {
+		if (linkAndStark == NULL) return;
+		frequency = _frequency;
+		linkAndStark->setFrequency(frequency);
+
+		float position = frequency / FREQUENCY_STEP;
+		if (!(position >= 0 && position <= rows - 1)) {
+			row = -1;
+			return;
+		}
+		row = std::min((int) position, rows - 2);
+		rowWeight = position - row;
+	}
+
+	/**
+	 * Light instensity in Blondels
+	 * Response latency in Milliseconds (ms)
+	 */
+	float pupilLatencyAt(float intensity) {
+		if (!(intensity >= FIRST_BLONDELS && intensity < LAST_BLONDELS) || row < 0) {
+			return model->pupilLatencyAt(intensity);
+		}
+
+		uint32_t bits;
+		memcpy(&bits, &intensity, sizeof(bits));
+		uint32_t offset = bits - FIRST_BITS;
+		int i = offset >> FRACTION_BITS;
+		float fraction = (offset & ((1 << FRACTION_BITS) - 1)) * (1.0f / (1 << FRACTION_BITS));
+
+		const float * a = &values[row * (SEGMENTS + 1) + i];
+		float latency = a[0] + (a[1] - a[0]) * fraction;
+		if (rowWeight != 0) {
+			const float * b = a + SEGMENTS + 1;
+			latency += (b[0] + (b[1] - b[0]) * fraction - latency) * rowWeight;
+		}
+		return latency;
+	}
+
+	virtual void pupilLatencyAt(const float * intensities, float * latencies, size_t n) {
+		for (size_t i=0; i<n; i++) {
+			latencies[i] = TabulatedLatencyModel::pupilLatencyAt(intensities[i]);
+		}
+	}
+
+	/**
+	 * Largest difference (ms) to the wrapped model at the current
+	 * frequency, taken in the middle of every segment.
+	 */
+	float maxError() {
+		float worst = 0;
+		for (int i=0; i<SEGMENTS; i++) {
+			float intensity = intensityAt(((uint32_t) i << FRACTION_BITS) + (1 << (FRACTION_BITS - 1)));
+			worst = std::max(worst, fabsf(TabulatedLatencyModel::pupilLatencyAt(intensity) - model->pupilLatencyAt(intensity)));
+		}
+		return worst;
+	}
+};
+
+#endif /*TABULATEDLATENCYMODEL_H_*/
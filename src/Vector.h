@@ -19,8 +19,13 @@
 #ifndef VECTOR_H_
 #define VECTOR_H_
 
+#include <type_traits>
+
 /**
  * Simple Linear Algebra Vector class
+ *
+ * Trivially copyable, with no vtable: an array of vectors is the array of
+ * their coordinates and can be copied with memcpy.
  */ 
 template <class C, int N>
 class Vector {
@@ -28,28 +33,13 @@ class Vector {
 public:
 	C data[N];
 
-	Vector() {
-		clear();
-	}
-	virtual ~Vector() {}
+	constexpr Vector() : data() {}
 	
-	Vector(C x, C y) {
-		data[0] = x;
-		data[1] = y;
-	}
+	constexpr Vector(C x, C y) : data{x, y} {}
 	
-	Vector(C x, C y, C z) {
-		data[0] = x;
-		data[1] = y;
-		data[2] = z;
-	}	
+	constexpr Vector(C x, C y, C z) : data{x, y, z} {}
 
-	Vector(C x, C y, C z, C w) {
-		data[0] = x;
-		data[1] = y;
-		data[2] = z;
-		data[3] = w;
-	}	
+	constexpr Vector(C x, C y, C z, C w) : data{x, y, z, w} {}
 
 	inline void clear() {
 		for (int i=0; i<N; i++) {
@@ -58,28 +48,26 @@ public:
 	}		
 		
 	void copy(const Vector<C,N> & to) {
-		for (int i=0; i<N; i++) {
-			data[i] = to.data[i];
-		}
+		*this = to;
 	}			
 	
-    inline C operator [] (int index) const {
+    constexpr C operator [] (int index) const {
     	 return data[index];
     }   	
 
-	inline C x() {
+	constexpr C x() const {
 		return data[0];
 	}
 
-	inline C y() {
+	constexpr C y() const {
 		return data[1];
 	}
 
-	inline C z() {
+	constexpr C z() const {
 		return data[2];
 	}
 
-	inline C w() {
+	constexpr C w() const {
 		return data[3];
 	}
 
@@ -184,7 +172,7 @@ public:
 		return true;
    	}     
     
-    double distance(const Vector<C,N> & to) {
+    double distance(const Vector<C,N> & to) const {
 		float dist1D;
 		float distND = 0;
 		for (int i=0; i<N; i++) {
@@ -195,7 +183,7 @@ public:
 		return sqrt(distND);
 	}
 	
-    double squareRoot() {
+    double squareRoot() const {
 		float distND = 0;
 		for (int i=0; i<N; i++) {
 			distND += data[i] * data[i];
@@ -214,11 +202,11 @@ public:
 	}		
 	
 
-	bool equals(double a, double b) {
+	bool equals(double a, double b) const {
 		return fabs(a - b) < 0.001;
 	}
 
-	bool equals(double x, double y, double epsilon) {
+	bool equals(double x, double y, double epsilon) const {
 		return fabs(data[0] - x) < epsilon && fabs(data[1] - y) < epsilon;
 	}	
 	
@@ -229,21 +217,21 @@ public:
 		}
 	}
 	
-	bool isZero() {
+	bool isZero() const {
 		for (int i=0; i<N; i++) {
 			if (!equals(data[i], 0.000f)) return false;
 		}
 		return true;
 	}
 	
-	inline bool operator == (const Vector<C,N> & other) {
+	inline bool operator == (const Vector<C,N> & other) const {
 		for (int i=0; i<N; i++) {
 			if (!equals(data[i], other[i])) return false;
 		}
 		return true;
 	}
 	
-	double dot( const Vector<C,N> & other ) {
+	double dot( const Vector<C,N> & other ) const {
 		double total = 0;
 		for (int i=0; i<N; i++) {
 			total += data[i] * other.data[i];
@@ -251,20 +239,20 @@ public:
 		return total;
 	}
 	
-	double dotProduct( const Vector<C,N> & other ) {
+	double dotProduct( const Vector<C,N> & other ) const {
 		return dot(other);
 	}	
 	
-	float angleInDegree( const Vector<C,N> &v2 ) {
+	float angleInDegree( const Vector<C,N> &v2 ) const {
 	    return acos(dot(v2)/(length() * v2.length())) * 180/ M_PI;
 	}
 	
-	float angleInRadians( const Vector<C,N> &v2 ) {
+	float angleInRadians( const Vector<C,N> &v2 ) const {
 	    return acos(dot(v2)/(length() * v2.length()));
 	}
 	
 	// SOMENTE PARA 3D!!! 
-	Vector<C,N> crossProduct3D(const Vector<C, N> &v2) {
+	Vector<C,N> crossProduct3D(const Vector<C, N> &v2) const {
 	    Vector<C,N> vCrossProduct;
 	
 	    vCrossProduct.data[0] =  data[1] * v2.data[2] - data[2] * v2.data[1];
@@ -274,7 +262,7 @@ public:
 	    return vCrossProduct;
 	}
 	
-	Vector<C,N> crossProduct2D(const Vector<C, N> &v2) {
+	Vector<C,N> crossProduct2D(const Vector<C, N> &v2) const {
 	    Vector<C,N> vCrossProduct;
 	
 	    vCrossProduct.data[0] =  data[0] * v2.data[1];
@@ -283,7 +271,7 @@ public:
 	    return vCrossProduct;
 	}	
 	
-	Vector<C,N> crossProduct(const Vector<C, N> &v2) {
+	Vector<C,N> crossProduct(const Vector<C, N> &v2) const {
 		if (N == 2) {
 			return crossProduct2D(v2);
 		} else if (N==3) {
@@ -295,7 +283,7 @@ public:
 	}
 		
 	
-	double sumAll() {
+	double sumAll() const {
 		double ret = 0;
 	    for (int i=0; i<N; i++) {
 	    	ret += data[i];
@@ -304,7 +292,7 @@ public:
 	}
 	
 	// SOMENTE PARA 3D!!! 
-	Vector<C,N> addToLength(double toAdd) {
+	Vector<C,N> addToLength(double toAdd) const {
 	    C l = length();
 	    
 	    double percent = (l+toAdd)/l;
@@ -316,7 +304,7 @@ public:
 	    return ret;
 	}
 	
-    std::string print() {
+    std::string print() const {
     	std::stringstream stream;
 
         bool first = true;
@@ -343,4 +331,7 @@ typedef Vector<float, 2> Vector2f;
 typedef Vector<float, 3> Vector3f;
 typedef Vector<float, 4> Vector4f;
 
+static_assert(std::is_trivially_copyable<Vector3f>::value && sizeof(Vector3f) == 3 * sizeof(float),
+              "Vector must stay a plain array of coordinates");
+
 #endif /*VECTOR_H_*/
@@ -0,0 +1,1786 @@
+#include "PupilLifecycle.h"
+#include "Benchmark.h"
+
+#include <fstream>
+#include <unistd.h>
+
+/**
+ * The vector based history used before HistoryFifo became a ring buffer.
+ * Kept here as the baseline of the history benchmark.
+ */
+template <class T, int limit>
+class VectorHistoryFifo {
+public:
+	std::vector<T> history;
+
+	void add(T value) {
+		history.push_back(value);
+		if (history.size()>limit) {
+			history.erase(history.begin());
+		}
+	}
+
+	int lastIndexAtOrBefore(double time) {
+		for (int i=history.size()-1; i>=0; i--) {
+			if (!(time < history[i].x())) return i;
+		}
+		return -1;
+	}
+};
+
+template <class Fifo>
+double benchmarkPush(Fifo & fifo, int from, int pushes) {
+	BenchmarkTimer timer;
+	for (int i=from; i<from+pushes; i++) {
+		fifo.add(Vector3f(i, 1.0f, 2.0f));
+	}
+	return timer.elapsedSeconds();
+}
+
+template <class Fifo>
+double benchmarkLookup(Fifo & fifo, int lookups, int newest, int depth) {
+	BenchmarkTimer timer;
+	long found = 0;
+	for (int i=0; i<lookups; i++) {
+		found += fifo.lastIndexAtOrBefore(newest - 0.5 - (i % depth));
+	}
+	doNotOptimize(found);
+	return timer.elapsedSeconds();
+}
+
+template <int capacity>
+void benchmarkHistory(const std::string & label) {
+	// Pushes and lookups are measured once the buffers are full.
+	int pushes = capacity >= 100000 ? 20000 : 200000;
+	int lookups = 200000;
+
+	VectorHistoryFifo<Vector3f, capacity> * vectorFifo = new VectorHistoryFifo<Vector3f, capacity>();
+	HistoryFifo<Vector3f, capacity> * ringFifo = new HistoryFifo<Vector3f, capacity>();
+
+	benchmarkPush(*vectorFifo, 0, capacity);
+	benchmarkPush(*ringFifo, 0, capacity);
+
+	reportBenchmark("history/" + label + "/vector/push", pushes, benchmarkPush(*vectorFifo, capacity, pushes));
+	reportBenchmark("history/" + label + "/ring/push", pushes, benchmarkPush(*ringFifo, capacity, pushes));
+
+	int newest = capacity + pushes - 1;
+	reportBenchmark("history/" + label + "/vector/lookup-recent", lookups, benchmarkLookup(*vectorFifo, lookups, newest, 8));
+	reportBenchmark("history/" + label + "/ring/lookup-recent", lookups, benchmarkLookup(*ringFifo, lookups, newest, 8));
+	reportBenchmark("history/" + label + "/vector/lookup-anywhere", lookups / 10, benchmarkLookup(*vectorFifo, lookups / 10, newest, capacity));
+	reportBenchmark("history/" + label + "/ring/lookup-anywhere", lookups / 10, benchmarkLookup(*ringFifo, lookups / 10, newest, capacity));
+
+	delete vectorFifo;
+	delete ringFifo;
+}
+
+/** Bytes taken by a delay model, its history and archive included */
+template <class Model>
+void reportFootprint(const std::string & name) {
+	Model * model = new Model();
+	size_t history = model->getHistory().capacity() * sizeof(model->getHistory()[0]);
+	size_t archive = HistoryArchive::TIERS * HistoryArchive::BUCKETS * sizeof(PupilSample);
+	std::cout << "footprint/" << name << ": " << sizeof(Model) + history + archive << " bytes, "
+	          << history << " of history, " << archive << " of archive" << std::endl;
+	delete model;
+}
+
+/**
+ * Light level in lumens/mm2 of a pupil at a step: each pupil sees its own
+ * sequence of dark and bright periods.
+ */
+float crowdIntensity(int pupil, int step) {
+	float blondels = ((step / 10 + pupil) % 3) * 2.0f - 2.0f;
+	return Conversion::blondelToLumensSquareMillimeter(powf(10, blondels + (pupil % 7) * 0.1f));
+}
+
+void benchmarkBatch(int pupils, int steps) {
+	float dt = 100;
+	float latency = 250;
+	float seedIntensity = Conversion::blondelToLumensSquareMillimeter(powf(10, -2));
+	float seedArea = Conversion::diameterToArea(7.1f);
+
+	std::vector<PamplonaAndOliveiraModel> models(pupils);
+	PupilBatch batch(pupils);
+	PupilBatch vectorizedBatch(pupils);
+	vectorizedBatch.setVectorized(true);
+
+	for (int i=0; i<10; i++) {
+		for (int p=0; p<pupils; p++) {
+			models[p].addPulse(100 * i, seedIntensity, seedArea);
+		}
+		batch.addPulse(100 * i, seedIntensity, seedArea);
+		vectorizedBatch.addPulse(100 * i, seedIntensity, seedArea);
+	}
+
+	std::vector<float> intensities(pupils);
+	std::vector<float> diameters(pupils);
+	float time = 900;
+	double modelsSeconds = 0;
+	double batchSeconds = 0;
+	double vectorizedSeconds = 0;
+	float maxDifference = 0;
+	float maxVectorizedDifference = 0;
+
+	for (int s=0; s<steps; s++) {
+		for (int p=0; p<pupils; p++) {
+			intensities[p] = crowdIntensity(p, s);
+		}
+		time += dt;
+
+		BenchmarkTimer timer;
+		for (int p=0; p<pupils; p++) {
+			diameters[p] = models[p].pupilDiameterAt(intensities[p], latency, time);
+		}
+		modelsSeconds += timer.elapsedSeconds();
+
+		timer.restart();
+		batch.step(dt, &intensities[0], latency);
+		batchSeconds += timer.elapsedSeconds();
+
+		timer.restart();
+		vectorizedBatch.step(dt, &intensities[0], latency);
+		vectorizedSeconds += timer.elapsedSeconds();
+
+		for (int p=0; p<pupils; p++) {
+			maxDifference = std::max(maxDifference, (float) fabs(diameters[p] - batch.getDiameter(p)));
+			maxVectorizedDifference = std::max(maxVectorizedDifference, (float) fabs(diameters[p] - vectorizedBatch.getDiameter(p)));
+		}
+	}
+
+	std::stringstream label;
+	label << "batch/" << pupils;
+	reportBenchmark(label.str() + "/models/step", (double) pupils * steps, modelsSeconds);
+	reportBenchmark(label.str() + "/batch/step", (double) pupils * steps, batchSeconds);
+	reportBenchmark(label.str() + "/vectorized/step", (double) pupils * steps, vectorizedSeconds);
+	std::cout << label.str() << "/batch/frame: " << batchSeconds / steps * 1.0e6 << " us, "
+	          << "max difference to models: " << maxDifference << " mm" << std::endl;
+	std::cout << label.str() << "/vectorized/frame: " << vectorizedSeconds / steps * 1.0e6 << " us, "
+	          << "max difference to models: " << maxVectorizedDifference << " mm" << std::endl;
+}
+
+void benchmarkSolver(int pupils) {
+	std::vector<float> prevDiameters(pupils);
+	std::vector<float> rightSides(pupils);
+	std::vector<float> scalar(pupils);
+	std::vector<float> vectorized(pupils);
+	float dT = 100 / 500.0f;
+	double minimumThreshold = PamplonaAndOliveiraModel::evalPhiBar();
+
+	srand(1);
+	for (int p=0; p<pupils; p++) {
+		float blondels = -5 + 8.0f * rand() / RAND_MAX;
+		prevDiameters[p] = 2.5f + 5.0f * rand() / RAND_MAX;
+		float flux = Conversion::blondelToLumensSquareMillimeter(powf(10, blondels)) * Conversion::diameterToArea(prevDiameters[p]);
+		rightSides[p] = PamplonaAndOliveiraModel::muscleActivityForFlux(flux, minimumThreshold);
+	}
+
+	BenchmarkTimer timer;
+	for (int p=0; p<pupils; p++) {
+		scalar[p] = PamplonaAndOliveiraModel::solveDiameter(prevDiameters[p], dT, rightSides[p]);
+	}
+	double scalarSeconds = timer.elapsedSeconds();
+
+	std::vector<float> newton(pupils);
+	long newtonIterations = 0;
+	timer.restart();
+	for (int p=0; p<pupils; p++) {
+		int iterations;
+		bool diverged;
+		newton[p] = PamplonaAndOliveiraModel::solveDiameterWithNewton(prevDiameters[p], dT, rightSides[p], iterations, diverged);
+		newtonIterations += iterations;
+	}
+	double newtonSeconds = timer.elapsedSeconds();
+
+	timer.restart();
+	int diverged = PamplonaAndOliveiraBatchSolver::solveDiameters(&prevDiameters[0], dT, &rightSides[0], &vectorized[0], pupils);
+	double vectorizedSeconds = timer.elapsedSeconds();
+
+	float maxDifference = 0;
+	for (int p=0; p<pupils; p++) {
+		maxDifference = std::max(maxDifference, (float) fabs(scalar[p] - vectorized[p]));
+	}
+
+	float maxNewtonDifference = 0;
+	for (int p=0; p<pupils; p++) {
+		maxNewtonDifference = std::max(maxNewtonDifference, (float) fabs(scalar[p] - newton[p]));
+	}
+
+	reportBenchmark("solver/scalar", pupils, scalarSeconds);
+	reportBenchmark("solver/newton", pupils, newtonSeconds);
+	std::cout << "solver/newton: " << (double) newtonIterations / pupils << " iterations per solve, "
+	          << "max difference to step halving: " << maxNewtonDifference << " mm" << std::endl;
+	reportBenchmark("solver/vectorized", pupils, vectorizedSeconds);
+	std::cout << "solver/vectorized: max difference to scalar: " << maxDifference << " mm, "
+	          << diverged << " diverged" << std::endl;
+
+#ifdef PLR_SIMD
+	float maxLogError = 0;
+	for (float x = 1.0e-6f; x < 1.0e6f; x *= 1.001f) {
+		float approximated[FLOAT_PACK_WIDTH];
+		log(FloatPack(x)).store(approximated);
+		maxLogError = std::max(maxLogError, (float) fabs((approximated[0] - log((double) x)) / log((double) x)));
+	}
+	std::cout << "solver/vectorized: FloatPack width " << FLOAT_PACK_WIDTH
+	          << ", max relative error of log: " << maxLogError << std::endl;
+#endif
+}
+
+/**
+ * The scenario of main.cpp: 10 pulses at a dark 7.1 mm pupil, then 20 steps
+ * at -2 and 20 steps at 2 blondels, 100 ms apart, with 250 ms of latency.
+ */
+template <class Model>
+void benchmarkIterations(const std::string & name, Model & model, SolverType solver) {
+	float time = 100;
+	float intensity = Conversion::blondelToLumensSquareMillimeter(powf(10, -2));
+	float lastDiameter = 0;
+
+	model.setSolver(solver);
+	for (int i=0; i<10; i++) {
+		model.addPulse(time, intensity, Conversion::diameterToArea(7.1f));
+		time += 100;
+	}
+
+	BenchmarkTimer timer;
+	for (int i=0; i<40; i++) {
+		intensity = Conversion::blondelToLumensSquareMillimeter(powf(10, i < 20 ? -2 : 2));
+		lastDiameter = model.pupilDiameterAt(intensity, 250, time);
+		time += 100;
+	}
+	double seconds = timer.elapsedSeconds();
+
+	ModelInstrumentation & instrumentation = model.getInstrumentation();
+	std::cout << "iterations/" << name << "/" << (solver == NEWTON_SOLVER ? "newton" : "step-halving") << ": "
+	          << instrumentation.averageIterations() << " evaluations per step (max "
+	          << instrumentation.maxIterations << "), " << instrumentation.divergences << " diverged, "
+	          << instrumentation.unconverged << " not converged, " << seconds * 1.0e9 / instrumentation.solves << " ns/step, final diameter " << lastDiameter << " mm" << std::endl;
+}
+
+/**
+ * Runs Pamplona's model from a dark adapted 7.1 mm pupil through 2 s at -2,
+ * 2 s at 2 and 2 s at -2 blondels, stepping every dt ms and sampling the
+ * diameter every 100 ms.
+ */
+std::vector<float> runIntegrator(IntegratorType integrator, int dt, double & seconds) {
+	PamplonaAndOliveiraModel model;
+	model.setIntegrator(integrator);
+
+	float dark = Conversion::blondelToLumensSquareMillimeter(powf(10, -2));
+	float bright = Conversion::blondelToLumensSquareMillimeter(powf(10, 2));
+
+	for (int t = -900; t <= 0; t += dt) {
+		model.addPulse(t, dark, Conversion::diameterToArea(7.1f));
+	}
+
+	std::vector<float> frames;
+	BenchmarkTimer timer;
+	for (int t = dt; t <= 6000; t += dt) {
+		float intensity = (t > 2000 && t <= 4000) ? bright : dark;
+		float diameter = model.pupilDiameterAt(intensity, 250, t);
+		if (t % 100 == 0) frames.push_back(diameter);
+	}
+	seconds = timer.elapsedSeconds();
+
+	return frames;
+}
+
+void reportIntegrator(const std::string & name, IntegratorType integrator, int dt, const std::vector<float> & reference) {
+	double seconds;
+	std::vector<float> frames = runIntegrator(integrator, dt, seconds);
+
+	double maxError = 0;
+	double squaredError = 0;
+	for (unsigned int i=0; i<frames.size(); i++) {
+		double error = fabs(frames[i] - reference[i]);
+		maxError = std::max(maxError, error);
+		squaredError += error * error;
+	}
+
+	std::cout << "integrators/" << name << "/" << dt << "ms: max error " << maxError
+	          << " mm, rms error " << sqrt(squaredError / frames.size()) << " mm, "
+	          << seconds * 1.0e9 / (6000 / dt) << " ns/step" << std::endl;
+}
+
+/**
+ * Max interpolation error of a table against its exact function, sampling
+ * 100 points between every pair of entries, and the time of both per call.
+ */
+template <class Exact>
+void benchmarkTable(const std::string & name, const LookupTable<LookupTables::SIZE> & table,
+                    double (*reference)(double), Exact exact) {
+	int samples = LookupTables::SIZE * 100;
+	double step = (table.last - table.first) / samples;
+
+	double maxError = 0;
+	for (int i=0; i<=samples; i++) {
+		double x = table.first + i * step;
+		maxError = std::max(maxError, fabs(table.at(x) - reference(x)));
+	}
+
+	float sum = 0;
+	BenchmarkTimer timer;
+	for (int i=0; i<=samples; i++) {
+		sum += exact(table.first + i * step);
+	}
+	double exactSeconds = timer.elapsedSeconds();
+	doNotOptimize(sum);
+
+	timer.restart();
+	for (int i=0; i<=samples; i++) {
+		sum += table.at(table.first + i * step);
+	}
+	double tableSeconds = timer.elapsedSeconds();
+	doNotOptimize(sum);
+
+	std::cout << "tables/" << name << ": [" << table.first << ", " << table.last << "], max error " << maxError
+	          << ", exact " << exactSeconds * 1.0e9 / samples << " ns, table "
+	          << tableSeconds * 1.0e9 / samples << " ns" << std::endl;
+}
+
+double exactM(double diameter) {
+	double x = (diameter - 4.9) / 3;
+	return 0.5 * (log(1+x) - log(1-x));
+}
+
+double exactHillFunctionInverse(double area) {
+	return 10 * pow(46.19 / (area - 2.7) - 1, 1.0 / 55);
+}
+
+/**
+ * Counts the heap allocations of pupilDiameterAt once the model is warmed
+ * up. Returns false if there was any.
+ */
+template <class Model>
+bool checkAllocations(const std::string & name, Model & model) {
+	float time = 0;
+	float dark = Conversion::blondelToLumensSquareMillimeter(powf(10, -2));
+	float bright = Conversion::blondelToLumensSquareMillimeter(powf(10, 2));
+
+	for (int i=0; i<10; i++) {
+		model.addPulse(time, dark, Conversion::diameterToArea(7.1f));
+		time += 100;
+	}
+	for (int i=0; i<100; i++) {
+		model.pupilDiameterAt(dark, 250, time);
+		time += 10;
+	}
+
+	int steps = 10000;
+	long before = AllocationCounter::count();
+	for (int i=0; i<steps; i++) {
+		float intensity = (i / 200) % 2 ? bright : dark;
+		doNotOptimize(model.pupilDiameterAt(intensity, 250, time));
+		time += 10;
+	}
+	long allocations = AllocationCounter::count() - before;
+
+	std::cout << "allocations/" << name << ": " << (double) allocations / steps << " per step"
+	          << (allocations == 0 ? "" : " FAILED") << std::endl;
+	return allocations == 0;
+}
+
+/**
+ * Independent lifecycles stepped by one thread of the threads benchmark.
+ */
+class LifecycleWorker {
+public:
+	std::vector<PupilLifecycle> lifecycles;
+	std::vector<float> diameters;
+	int steps;
+	pthread_t thread;
+};
+
+/**
+ * Steps Pamplona's model every 10 ms, alternating 1 s at -2 and 1 s at 2
+ * blondels, with a different phase per lifecycle.
+ */
+void * stepLifecycles(void * argument) {
+	LifecycleWorker * worker = (LifecycleWorker *) argument;
+
+	for (unsigned int l=0; l<worker->lifecycles.size(); l++) {
+		PupilLifecycle & lifecycle = worker->lifecycles[l];
+		float diameter = 0;
+		for (int i=0; i<worker->steps; i++) {
+			float blondels = ((i + 10 * l) / 100) % 2 ? 2 : -2;
+			diameter = lifecycle.getDiameter(i * 10, powf(10, blondels));
+		}
+		worker->diameters[l] = diameter;
+	}
+	return NULL;
+}
+
+std::vector<LifecycleWorker> createWorkers(int threads, int lifecyclesPerThread, int steps) {
+	std::vector<LifecycleWorker> workers(threads);
+	for (int t=0; t<threads; t++) {
+		workers[t].steps = steps;
+		workers[t].diameters.resize(lifecyclesPerThread);
+		for (int l=0; l<lifecyclesPerThread; l++) {
+			PupilLifecycle lifecycle;
+			lifecycle.setPamplonaModel(0);
+			workers[t].lifecycles.push_back(std::move(lifecycle));
+		}
+	}
+	return workers;
+}
+
+/**
+ * Steps threads * lifecyclesPerThread lifecycles, each thread with its own.
+ * Every lifecycle must end as it does when stepped alone.
+ */
+void benchmarkThreads(int threads, int lifecyclesPerThread, int steps, double & singleThreadRate) {
+	std::vector<LifecycleWorker> workers = createWorkers(threads, lifecyclesPerThread, steps);
+
+	BenchmarkTimer timer;
+	for (int t=0; t<threads; t++) {
+		pthread_create(&workers[t].thread, NULL, stepLifecycles, &workers[t]);
+	}
+	for (int t=0; t<threads; t++) {
+		pthread_join(workers[t].thread, NULL);
+	}
+	double seconds = timer.elapsedSeconds();
+
+	// the same lifecycles, stepped on this thread only
+	std::vector<LifecycleWorker> reference = createWorkers(1, lifecyclesPerThread, steps);
+	stepLifecycles(&reference[0]);
+
+	int mismatches = 0;
+	for (int t=0; t<threads; t++) {
+		for (int l=0; l<lifecyclesPerThread; l++) {
+			if (workers[t].diameters[l] != reference[0].diameters[l]) mismatches++;
+		}
+	}
+
+	double rate = (double) threads * lifecyclesPerThread * steps / seconds;
+	if (threads == 1) singleThreadRate = rate;
+
+	std::ostringstream label;
+	label << "threads/" << threads;
+	reportBenchmark(label.str() + "/step", (double) threads * lifecyclesPerThread * steps, seconds);
+	std::cout << label.str() << ": speedup " << rate / singleThreadRate << ", "
+	          << mismatches << " lifecycles differ from single threaded" << std::endl;
+}
+
+/**
+ * Steps pupils * PupilLifecycle of Pamplona's model for frames of 10 ms.
+ * The first quarter of the pupils sees a flash every 200 ms while the others
+ * stay in the dark, so a static partition puts most of the work on the first
+ * worker. Returns the final diameters.
+ */
+std::vector<float> benchmarkScheduler(int threads, int pupils, int frames, bool workStealing) {
+	std::vector<PupilLifecycle> lifecycles(pupils);
+	PupilScheduler scheduler(threads);
+	scheduler.setWorkStealing(workStealing);
+
+	for (int p=0; p<pupils; p++) {
+		lifecycles[p].setPamplonaModel(0);
+		scheduler.add(&lifecycles[p]);
+	}
+
+	std::vector<float> intensities(pupils);
+	std::vector<double> busy(threads);
+	std::vector<int> stolen(threads);
+	double wallSeconds = 0;
+	double slowestFrame = 0;
+
+	for (int f=1; f<=frames; f++) {
+		for (int p=0; p<pupils; p++) {
+			bool flash = p < pupils / 4 && (f / 10) % 2 == 1;
+			intensities[p] = powf(10, flash ? 2 : -2);
+		}
+
+		scheduler.step(f * 10, &intensities[0]);
+
+		wallSeconds += scheduler.getFrameSeconds();
+		slowestFrame = std::max(slowestFrame, scheduler.getFrameSeconds());
+		for (int w=0; w<threads; w++) {
+			busy[w] += scheduler.getWorkerStatistics(w).busySeconds;
+			stolen[w] += scheduler.getWorkerStatistics(w).stolen;
+		}
+	}
+
+	std::ostringstream label;
+	label << "scheduler/" << threads << "/" << (workStealing ? "stealing" : "static");
+	std::cout << label.str() << ": " << pupils << " pupils, chunks of " << scheduler.getChunkSize()
+	          << ", frame " << wallSeconds / frames * 1.0e6 << " us (slowest " << slowestFrame * 1.0e6 << " us)" << std::endl;
+	for (int w=0; w<threads; w++) {
+		std::cout << label.str() << "/worker " << w << ": utilization " << busy[w] / wallSeconds
+		          << ", " << stolen[w] << " chunks stolen" << std::endl;
+	}
+
+	return scheduler.getDiameters();
+}
+
+/** Resident memory of the process in KB, 0 if unknown */
+long residentKilobytes() {
+	long pages = 0;
+	long resident = 0;
+	FILE * statm = fopen("/proc/self/statm", "r");
+	if (statm == NULL) return 0;
+	if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+	fclose(statm);
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/**
+ * Steps one lifecycle of Pamplona's model every millisecond with a new
+ * intensity every step, reporting memory and speed every million steps.
+ */
+void benchmarkSoak(int steps) {
+	PupilLifecycle lifecycle;
+	lifecycle.setPamplonaModel(0);
+
+	int report = 1000000;
+	BenchmarkTimer timer;
+	for (int i=1; i<=steps; i++) {
+		float blondels = (i / 500) % 2 ? 2 : -2;
+		doNotOptimize(lifecycle.getDiameter(i, powf(10, blondels + (i % 7) * 0.01f)));
+
+		if (i % report == 0) {
+			std::cout << "soak/" << i / report << "M: " << residentKilobytes() << " KB resident, "
+			          << timer.elapsedSeconds() * 1.0e9 / report << " ns/step" << std::endl;
+			timer.restart();
+		}
+	}
+}
+
+/**
+ * Steps a PupilLifecycle and a StaticPupilLifecycle with the same models
+ * every 10 ms through alternating light, and compares speed and diameters.
+ */
+template <class Dynamics, class Latency>
+void benchmarkLifecycle(const std::string & name, PupilModelId dynamicsId, LatencyModelId latencyId,
+                        const Dynamics & dynamics, const Latency & latency, int steps) {
+	PupilLifecycle virtualLifecycle(dynamicsId, latencyId, 0);
+
+	StaticPupilLifecycle<Dynamics, Latency> staticLifecycle(dynamics, latency, 0);
+
+	std::vector<float> intensities(steps);
+	for (int i=0; i<steps; i++) {
+		intensities[i] = powf(10, (i / 100) % 2 ? 2 : -2);
+	}
+
+	std::vector<float> virtualDiameters(steps);
+	BenchmarkTimer timer;
+	for (int i=0; i<steps; i++) {
+		virtualDiameters[i] = virtualLifecycle.getDiameter((i+1) * 10, intensities[i]);
+	}
+	double virtualSeconds = timer.elapsedSeconds();
+
+	std::vector<float> staticDiameters(steps);
+	timer.restart();
+	for (int i=0; i<steps; i++) {
+		staticDiameters[i] = staticLifecycle.getDiameter((i+1) * 10, intensities[i]);
+	}
+	double staticSeconds = timer.elapsedSeconds();
+
+	reportBenchmark("lifecycle/" + name + "/virtual", steps, virtualSeconds);
+	reportBenchmark("lifecycle/" + name + "/static", steps, staticSeconds);
+	// inlining lets the compiler contract different operations into FMAs
+	float maxDifference = 0;
+	for (int i=0; i<steps; i++) {
+		maxDifference = std::max(maxDifference, (float) fabs(virtualDiameters[i] - staticDiameters[i]));
+	}
+	std::cout << "lifecycle/" << name << ": max difference between static and virtual "
+	          << maxDifference << " mm" << std::endl;
+}
+
+/**
+ * Diameters of samples luminances from 1e-6 to 1e6 blondels with the scalar
+ * virtual call per sample and with the batch entry point.
+ */
+void benchmarkStaticModel(PupilDynamicsModel * model, int samples) {
+	std::vector<float> intensities(samples);
+	std::vector<float> scalar(samples);
+	std::vector<float> batch(samples);
+
+	srand(1);
+	for (int i=0; i<samples; i++) {
+		intensities[i] = powf(10, -6 + 12.0f * rand() / RAND_MAX);
+	}
+
+	int repeats = 20;
+	BenchmarkTimer timer;
+	for (int r=0; r<repeats; r++) {
+		for (int i=0; i<samples; i++) {
+			scalar[i] = model->pupilDiameterAt(intensities[i]);
+		}
+		doNotOptimize(scalar[0]);
+	}
+	double scalarSeconds = timer.elapsedSeconds();
+
+	timer.restart();
+	for (int r=0; r<repeats; r++) {
+		model->pupilDiameterAt(&intensities[0], &batch[0], samples);
+		doNotOptimize(batch[0]);
+	}
+	double batchSeconds = timer.elapsedSeconds();
+
+	float maxDifference = 0;
+	for (int i=0; i<samples; i++) {
+		maxDifference = std::max(maxDifference, (float) fabs(scalar[i] - batch[i]));
+	}
+
+	std::string name = "static/" + model->getName();
+	reportBenchmark(name + "/scalar", (double) repeats * samples, scalarSeconds);
+	reportBenchmark(name + "/batch", (double) repeats * samples, batchSeconds);
+	std::cout << name << ": speedup " << scalarSeconds / batchSeconds
+	          << ", max difference " << maxDifference << " mm" << std::endl;
+}
+
+/**
+ * Steps a lifecycle of Pamplona's model with and without a trace, checks
+ * the diameters read back from the mapped trace, and scans a larger trace
+ * column by column. Returns false if the trace does not match.
+ */
+bool benchmarkTrace(int steps, int scanSamples) {
+	std::string path = "/tmp/PLRBenchmark-" + std::to_string(getpid()) + ".trace";
+
+	PupilLifecycle untraced(PupilModelId::PAMPLONA_AND_OLIVEIRA, LatencyModelId::LINK_AND_STARK, 0);
+	BenchmarkTimer timer;
+	for (int i=1; i<=steps; i++) {
+		doNotOptimize(untraced.getDiameter(i * 10, powf(10, (i / 100) % 2 ? 2 : -2)));
+	}
+	double untracedSeconds = timer.elapsedSeconds();
+
+	std::vector<float> diameters(steps);
+	PupilLifecycle traced(PupilModelId::PAMPLONA_AND_OLIVEIRA, LatencyModelId::LINK_AND_STARK, 0);
+	PupilTraceWriter writer;
+	if (!writer.open(path.c_str())) {
+		std::cout << "trace: cannot write " << path << std::endl;
+		return false;
+	}
+	traced.getDynamics()->setTraceWriter(&writer);
+	timer.restart();
+	for (int i=1; i<=steps; i++) {
+		diameters[i-1] = traced.getDiameter(i * 10, powf(10, (i / 100) % 2 ? 2 : -2));
+	}
+	writer.close();
+	double tracedSeconds = timer.elapsedSeconds();
+
+	reportBenchmark("trace/untraced", steps, untracedSeconds);
+	reportBenchmark("trace/traced", steps, tracedSeconds);
+
+	PupilTraceReader reader;
+	bool matches = reader.open(path.c_str()) && reader.size() == (uint64_t) steps;
+	int sample = 0;
+	for (int b=0; matches && b<reader.blocks(); b++) {
+		const float * blockDiameters = reader.column(b, TRACE_DIAMETER);
+		for (uint32_t i=0; i<reader.blockSize(b); i++) {
+			matches &= blockDiameters[i] == diameters[sample++];
+		}
+	}
+	reader.close();
+	std::cout << "trace: " << steps << " steps read back, " << (matches ? "match" : "DIFFER") << std::endl;
+
+	// a long run written at once, then scanned from the page cache
+	if (!writer.open(path.c_str())) return false;
+	for (int i=0; i<scanSamples; i++) {
+		writer.append(i, 1, 20, 5 + (i % 100) * 0.01f, 250, 3);
+	}
+	writer.close();
+
+	reader.open(path.c_str());
+	for (int repeat=0; repeat<2; repeat++) {
+		timer.restart();
+		double sum = 0;
+		long iterations = 0;
+		for (int b=0; b<reader.blocks(); b++) {
+			const float * blockDiameters = reader.column(b, TRACE_DIAMETER);
+			const int32_t * blockIterations = reader.iterations(b);
+			float blockSum = 0;
+			for (uint32_t i=0; i<reader.blockSize(b); i++) {
+				blockSum += blockDiameters[i];
+				iterations += blockIterations[i];
+			}
+			sum += blockSum;
+		}
+		double seconds = timer.elapsedSeconds();
+		doNotOptimize(sum);
+		doNotOptimize(iterations);
+		std::cout << "trace/scan" << (repeat == 0 ? " (cold)" : "") << ": 2 columns of " << reader.size()
+		          << " samples at " << 2.0 * sizeof(float) * reader.size() / seconds / 1.0e9 << " GB/s" << std::endl;
+	}
+	reader.close();
+	unlink(path.c_str());
+	return matches;
+}
+
+/** Steps a lifecycle every 10 ms from time for steps steps of intensity blondels */
+float stepLifecycle(PupilLifecycle & lifecycle, int from, int steps, float blondels) {
+	float diameter = 0;
+	for (int i=from; i<from+steps; i++) {
+		diameter = lifecycle.getDiameter(i * 10, blondels);
+	}
+	return diameter;
+}
+
+/**
+ * Adapts pupils to a lit scene by stepping them from the dark, and by
+ * restoring a snapshot of one adapted pupil into default lifecycles. Both
+ * must then continue with the same diameters. Returns false if they do not.
+ */
+bool benchmarkCheckpoint(const std::string & name, PupilModelId id, int pupils, int warmSteps) {
+	PupilLifecycle adapted(id, LatencyModelId::LINK_AND_STARK, 0);
+	stepLifecycle(adapted, 1, warmSteps, 100);
+
+	std::vector<char> blob;
+	adapted.checkpoint(blob);
+
+	BenchmarkTimer timer;
+	for (int p=0; p<pupils; p++) {
+		PupilLifecycle lifecycle(id, LatencyModelId::LINK_AND_STARK, 0);
+		doNotOptimize(stepLifecycle(lifecycle, 1, warmSteps, 100));
+	}
+	double warmSeconds = timer.elapsedSeconds();
+
+	bool restored = true;
+	timer.restart();
+	for (int p=0; p<pupils; p++) {
+		PupilLifecycle lifecycle;
+		restored &= lifecycle.restore(blob);
+	}
+	double restoreSeconds = timer.elapsedSeconds();
+
+	PupilLifecycle lifecycle;
+	restored &= lifecycle.restore(blob);
+	bool matches = restored;
+	for (int i=warmSteps+1; i<=warmSteps+500; i++) {
+		float blondels = (i / 100) % 2 ? 1000 : 0.01f;
+		matches &= adapted.getDiameter(i * 10, blondels) == lifecycle.getDiameter(i * 10, blondels);
+	}
+
+	reportBenchmark("checkpoint/" + name + "/warm", pupils, warmSeconds);
+	reportBenchmark("checkpoint/" + name + "/restore", pupils, restoreSeconds);
+	std::cout << "checkpoint/" << name << ": " << blob.size() << " bytes, restore "
+	          << warmSeconds / restoreSeconds << "x faster than " << warmSteps << " warm steps, "
+	          << (matches ? "continues identically" : "DIFFERS") << std::endl;
+	return matches;
+}
+
+/**
+ * Spawns lifecycles adapted to ambient luminances and steps them under the
+ * same luminance for 5 s: an adapted pupil must not move. Reports the cost
+ * of sampling the steady state table, which the first spawn of a program
+ * pays, of a spawn, the drift and the distance to Moon and Spencer.
+ */
+void benchmarkSteadyState(const std::string & name, PupilModelId id, int spawns) {
+	float ambients[] = { 1.0e-4f, 1.0e-2f, 1, 100, 1.0e4f };
+	MoonAndSpencerModel moon;
+
+	double (*steadyState)(double) = id == PupilModelId::LONGTIN_AND_MILTON
+		? &TabulatedFunctions::longtinSteadyArea : &TabulatedFunctions::pamplonaSteadyDiameter;
+	BenchmarkTimer timer;
+	LookupTable<LookupTables::STEADY_SIZE> table(steadyState, -6, 6);
+	doNotOptimize(table);
+	reportBenchmark("steady/" + name + "/first use", 1, timer.elapsedSeconds());
+
+	timer.restart();
+	for (int i=0; i<spawns; i++) {
+		PupilLifecycle lifecycle(id, LatencyModelId::LINK_AND_STARK, 0, ambients[i % 5]);
+		doNotOptimize(lifecycle);
+	}
+	reportBenchmark("steady/" + name + "/spawn", spawns, timer.elapsedSeconds());
+
+	for (int a=0; a<5; a++) {
+		PupilLifecycle lifecycle(id, LatencyModelId::LINK_AND_STARK, 0, ambients[a]);
+		float first = lifecycle.getDiameter(10, ambients[a]);
+		float drift = 0;
+		for (int i=2; i<=500; i++) {
+			drift = std::max(drift, (float) fabs(lifecycle.getDiameter(i * 10, ambients[a]) - first));
+		}
+		std::cout << "steady/" << name << "/" << ambients[a] << " blondels: " << first << " mm, drift "
+		          << drift << " mm in 5 s, Moon and Spencer " << moon.pupilDiameterAt(ambients[a]) << " mm" << std::endl;
+	}
+}
+
+/** Blondels of a flash from 2 s to 2.5 s over dim light */
+float flashBlondels(float time) {
+	return time > 2000 && time <= 2500 ? 100 : 0.01f;
+}
+
+/**
+ * Diameters of Pamplona's model, with the Newton solver, every frame ms
+ * through a flash, stepped every step ms, or by an AdaptiveStepper when
+ * step is 0.
+ */
+std::vector<float> runFlash(float frame, float step, long & solves) {
+	PamplonaAndOliveiraModel model;
+	LinkAndStarkModel latency(0.4);
+	model.setSolver(NEWTON_SOLVER);
+	model.setSteadyState(0, 0.01f);
+	AdaptiveStepper stepper;
+	stepper.reset(&model, 0);
+
+	std::vector<float> diameters;
+	float time = 0;
+	solves = 0;
+	for (float frameTime = frame; frameTime <= 10000; frameTime += frame) {
+		float blondels = flashBlondels(frameTime);
+		float lumens = Conversion::blondelToLumensSquareMillimeter(blondels);
+		if (step == 0) {
+			diameters.push_back(stepper.advanceTo(frameTime, lumens, latency.pupilLatencyAt(blondels)));
+		} else {
+			float diameter = 0;
+			for (; time < frameTime; time += step, solves++) {
+				diameter = model.pupilDiameterAt(lumens, latency.pupilLatencyAt(blondels), time + step);
+			}
+			diameters.push_back(diameter);
+		}
+	}
+	if (step == 0) solves = stepper.getStatistics().solves;
+	return diameters;
+}
+
+/**
+ * Fixed and adaptive steps through a flash, against 1 ms steps.
+ */
+void benchmarkAdaptive(float frame) {
+	long solves;
+	std::vector<float> reference = runFlash(frame, 1, solves);
+
+	float steps[] = { frame, frame / 4, 0 };
+	for (int s=0; s<3; s++) {
+		std::vector<float> diameters = runFlash(frame, steps[s], solves);
+		float maxError = 0;
+		for (unsigned int i=0; i<reference.size(); i++) {
+			maxError = std::max(maxError, (float) fabs(diameters[i] - reference[i]));
+		}
+		std::stringstream name;
+		if (steps[s] == 0) name << "adaptive"; else name << steps[s] << " ms";
+		std::cout << "adaptive/" << frame << " ms frames/" << name.str() << ": " << solves
+		          << " solves, max error " << maxError << " mm" << std::endl;
+	}
+}
+
+/**
+ * Traces an AdaptiveStepper through a minute of flashes, long enough to
+ * fill the history, and replays the traced steps on a second model. The
+ * trace must hold the two halves of each accepted step, in time order, and
+ * the replay must give the same diameters and the same history and
+ * archive, which an undone attempt that lost a pulse would not. Returns
+ * false otherwise.
+ */
+bool validateAdaptiveTrace() {
+	std::string path = "/tmp/PLRBenchmark-" + std::to_string(getpid()) + "-adaptive.trace";
+
+	PamplonaAndOliveiraModel model;
+	LinkAndStarkModel latency(0.4);
+	model.setSolver(NEWTON_SOLVER);
+	model.setSteadyState(0, 0.01f);
+	PupilTraceWriter writer;
+	if (!writer.open(path.c_str())) {
+		std::cout << "adaptive/trace: cannot write " << path << std::endl;
+		return false;
+	}
+	model.setTraceWriter(&writer);
+	AdaptiveStepper stepper;
+	stepper.reset(&model, 0);
+	for (float frameTime = 100; frameTime <= 60000; frameTime += 100) {
+		float blondels = flashBlondels(fmodf(frameTime, 10000));
+		stepper.advanceTo(frameTime, Conversion::blondelToLumensSquareMillimeter(blondels), latency.pupilLatencyAt(blondels));
+	}
+	bool valid = writer.close();
+
+	PamplonaAndOliveiraModel replayed;
+	replayed.setSolver(NEWTON_SOLVER);
+	replayed.setSteadyState(0, 0.01f);
+	PupilTraceReader reader;
+	valid &= reader.open(path.c_str());
+	uint64_t samples = reader.size();
+	valid &= samples == 2 * (uint64_t) stepper.getStatistics().accepted;
+	float last = 0;
+	for (int b=0; valid && b<reader.blocks(); b++) {
+		const float * times = reader.column(b, TRACE_TIME);
+		const float * intensities = reader.column(b, TRACE_INTENSITY);
+		const float * latencies = reader.column(b, TRACE_LATENCY);
+		const float * diameters = reader.column(b, TRACE_DIAMETER);
+		for (uint32_t i=0; valid && i<reader.blockSize(b); i++) {
+			valid &= times[i] > last;
+			valid &= replayed.pupilDiameterAt(intensities[i], latencies[i], times[i]) == diameters[i];
+			last = times[i];
+		}
+	}
+	valid &= last == stepper.getTime();
+	reader.close();
+
+	std::vector<char> blob, replayedBlob;
+	ModelCheckpoint::save(model, PupilModelId::PAMPLONA_AND_OLIVEIRA, blob);
+	ModelCheckpoint::save(replayed, PupilModelId::PAMPLONA_AND_OLIVEIRA, replayedBlob);
+	valid &= blob == replayedBlob;
+	unlink(path.c_str());
+
+	std::cout << "adaptive/trace: " << samples << " samples of " << stepper.getStatistics().accepted
+	          << " accepted and " << stepper.getStatistics().rejected << " rejected steps, "
+	          << (valid ? "ok" : "FAIL") << std::endl;
+	return valid;
+}
+
+/**
+ * Cost of the parts of an envelope model step, 10 ms steps through light
+ * steps: the right side read from the history or reused, the solver and
+ * the subject variation.
+ */
+void benchmarkEnvelopeBreakdown(int steps) {
+	PamplonaAndOliveiraWithEnvelopeModel model;
+	model.setWithEnvelope(true);
+	model.setSolver(NEWTON_SOLVER);
+	model.setSteadyState(0, 0.01f);
+	float dark = Conversion::blondelToLumensSquareMillimeter(0.01f);
+	float bright = Conversion::blondelToLumensSquareMillimeter(100);
+
+	BenchmarkTimer timer;
+	float time = 0;
+	for (int i=0; i<steps; i++) {
+		time += 10;
+		doNotOptimize(model.pupilDiameterAt((i / 100) % 2 ? bright : dark, 250, time));
+	}
+	reportBenchmark("envelope/step", steps, timer.elapsedSeconds());
+
+	ModelInstrumentation & counters = model.getInstrumentation();
+	std::cout << "envelope/right sides: " << counters.fluxReused << " reused, " << counters.lookups << " read, "
+	          << counters.fluxLogarithms << " with a logarithm of " << counters.fluxReused + counters.lookups << std::endl;
+
+	// latencies 250 to 260 ms, so every call reads the history
+	timer.restart();
+	for (int i=0; i<steps; i++) {
+		doNotOptimize(model.muscleActivity(250 + (i % 1000) * 0.01f));
+	}
+	reportBenchmark("envelope/right side read", steps, timer.elapsedSeconds());
+
+	timer.restart();
+	for (int i=0; i<steps; i++) {
+		doNotOptimize(model.delayedMuscleActivity(250));
+	}
+	reportBenchmark("envelope/right side reused", steps, timer.elapsedSeconds());
+
+	timer.restart();
+	for (int i=0; i<steps; i++) {
+		int iterations;
+		bool diverged;
+		doNotOptimize(PamplonaAndOliveiraModel::solveDiameterWithNewton(3 + (i % 1000) * 0.004f, 10 / 600.0f, 5 + (i % 7) * 0.1f,
+		                                                                 iterations, diverged, 0.0000000001));
+	}
+	reportBenchmark("envelope/solver", steps, timer.elapsedSeconds());
+
+	timer.restart();
+	for (int i=0; i<steps; i++) {
+		doNotOptimize(model.applySubjectPupilVariation(3 + (i % 1000) * 0.004f, 0.42f));
+	}
+	reportBenchmark("envelope/subject variation", steps, timer.elapsedSeconds());
+}
+
+/** Steps of a delay model through light steps, every 10 ms, per second */
+template <class Model>
+double stepRate(Model & model, int steps) {
+	model.setSteadyState(0, 0.01f);
+	float dark = Conversion::blondelToLumensSquareMillimeter(0.01f);
+	float bright = Conversion::blondelToLumensSquareMillimeter(100);
+
+	BenchmarkTimer timer;
+	for (int i=1; i<=steps; i++) {
+		doNotOptimize(model.pupilDiameterAt((i / 100) % 2 ? bright : dark, 250, i * 10));
+	}
+	return steps / timer.elapsedSeconds();
+}
+
+/**
+ * The JSON of a divergence on an infinite right side, as a flux of 0 gives,
+ * must write null instead. Returns false if it writes inf or nan.
+ */
+bool validateInstrumentationJson() {
+	ModelInstrumentation instrumentation;
+	instrumentation.recordDivergence(100, 5, -log(0.0f));
+	instrumentation.recordDivergence(200, 5, nanf(""));
+	std::stringstream json;
+	instrumentation.writeJson(json);
+	bool valid = json.str().find("inf") == std::string::npos && json.str().find("nan") == std::string::npos
+	          && (instrumentation.divergences == 0 || json.str().find("\"right_side\": null") != std::string::npos);
+	std::cout << "instrumentation/json: " << (valid ? "ok" : "FAIL") << std::endl;
+	return valid;
+}
+
+/**
+ * Cost of the step timers, and the counters of each delay model as JSON.
+ * Build with -DPLR_NO_INSTRUMENTATION to compare with no counters.
+ */
+template <class Model>
+void benchmarkInstrumentation(const std::string & name, SolverType solver, int steps) {
+	Model counted;
+	Model timed;
+	counted.setSolver(solver);
+	timed.setSolver(solver);
+	timed.getInstrumentation().setTiming(true);
+
+	double countedRate = stepRate(counted, steps);
+	double timedRate = stepRate(timed, steps);
+	std::cout << "instrumentation/" << name << ": " << countedRate << " steps/s counted, "
+	          << timedRate << " steps/s timed" << std::endl;
+
+	std::cout << "instrumentation/" << name << ": ";
+	timed.writeInstrumentation(std::cout);
+	std::cout << std::endl;
+}
+
+/**
+ * Delayed flux lookups of a stepping model: the history gains an entry
+ * every 10 ms and the flux is read 250 ms back, with a binary search and
+ * with the DelayLookup cursor.
+ */
+void benchmarkDelayLookup(int steps) {
+	HistoryFifo<PupilSample, 1000> history;
+	DelayLookup<1000> delay(true, 0.1);
+	for (int i=0; i<1000; i++) history.add(PupilSample(i * 10, 1, 20));
+
+	BenchmarkTimer timer;
+	long found = 0;
+	for (int i=0; i<steps; i++) {
+		history.add(PupilSample((1000 + i) * 10, 1, 20));
+		found += history.lastIndexAtOrBefore(history.last().time - 250.0);
+	}
+	double searchSeconds = timer.elapsedSeconds();
+
+	timer.restart();
+	for (int i=0; i<steps; i++) {
+		history.add(PupilSample((1000 + steps + i) * 10, 1, 20));
+		found -= delay.find(history, history.last().time - 250.0);
+	}
+	double cursorSeconds = timer.elapsedSeconds();
+
+	reportBenchmark("delay/binary search", steps, searchSeconds);
+	reportBenchmark("delay/cursor", steps, cursorSeconds);
+	std::cout << "delay/lookups: " << (found == 0 ? "match" : "DIFFER") << std::endl;
+}
+
+/**
+ * Flux of a pupil following a 0.5 Hz light, read back from its history
+ * kept every period ms, against the history kept every ms.
+ */
+void benchmarkDelayInterpolation() {
+	PamplonaAndOliveiraModel model;
+	model.setSteadyState(0, 1);
+	for (int t=1; t<=900; t++) {
+		float blondels = powf(10, 1.5f * sinf(t * 2 * M_PI / 2000));
+		model.pupilDiameterAt(Conversion::blondelToLumensSquareMillimeter(blondels), 250, t);
+	}
+	const HistoryFifo<PupilSample, 1000> & fine = model.getHistory();
+	DelayLookup<1000> exact(true, 0.1);
+
+	int periods[] = { 5, 10, 20, 40, 80 };
+	for (int p=0; p<5; p++) {
+		HistoryFifo<PupilSample, 1000> coarse;
+		for (int i=0; i<fine.size(); i++) {
+			if ((int) fine[i].time % periods[p] == 0) coarse.add(fine[i]);
+		}
+
+		DelayLookup<1000> linear(true, 0.1);
+		DelayLookup<1000> hermite(true, 0.1);
+		hermite.setInterpolation(HERMITE_DELAY);
+
+		float linearError = 0;
+		float hermiteError = 0;
+		for (double t = 100; t <= 800; t += 0.25) {
+			float flux = exact.flux(fine, t);
+			linearError = std::max(linearError, fabsf(linear.flux(coarse, t) - flux) / flux);
+			hermiteError = std::max(hermiteError, fabsf(hermite.flux(coarse, t) - flux) / flux);
+		}
+		std::cout << "delay/every " << periods[p] << " ms: max flux error linear " << linearError
+		          << ", hermite " << hermiteError << std::endl;
+	}
+}
+
+/**
+ * Delayed flux lookups 400 ms back in a history kept every step ms, and
+ * the cost of archiving the pulses it drops. Below 0.4 ms the lookups
+ * read the archive.
+ */
+void benchmarkArchiveLookup(float step, int lookups) {
+	HistoryFifo<PupilSample, 1000> history;
+	HistoryArchive archive;
+	DelayLookup<1000> delay(true, 0.1);
+
+	int pushes = 100000;
+	BenchmarkTimer timer;
+	for (int i=0; i<pushes; i++) {
+		if (history.size() == history.capacity()) archive.add(history.first());
+		history.add(PupilSample(i * step, 1 + (i / 1000) % 2, 20));
+	}
+	double pushSeconds = timer.elapsedSeconds();
+
+	double newest = history.last().time;
+	float total = 0;
+	timer.restart();
+	for (int i=0; i<lookups; i++) {
+		total += delay.flux(history, newest - 400 - (i % 100) * 0.01, &archive);
+	}
+	double lookupSeconds = timer.elapsedSeconds();
+	doNotOptimize(total);
+
+	std::stringstream name;
+	name << "archive/" << step << " ms";
+	reportBenchmark(name.str() + "/push", pushes, pushSeconds);
+	reportBenchmark(name.str() + "/lookup", lookups, lookupSeconds);
+}
+
+/**
+ * Pamplona's model through a flash with a 355 ms latency, stepped below
+ * 1 ms, against 1 ms steps. The history alone spans less than the
+ * latency below 0.36 ms steps.
+ */
+void benchmarkArchiveAccuracy() {
+	long solves;
+	std::vector<float> reference = runFlash(10, 1, solves);
+
+	float steps[] = { 0.5f, 0.25f, 0.1f };
+	for (int s=0; s<3; s++) {
+		std::vector<float> diameters = runFlash(10, steps[s], solves);
+		float maxError = 0;
+		for (unsigned int i=0; i<reference.size(); i++) {
+			maxError = std::max(maxError, (float) fabs(diameters[i] - reference[i]));
+		}
+		std::cout << "archive/" << steps[s] << " ms steps: max error " << maxError << " mm against 1 ms steps" << std::endl;
+	}
+}
+
+/** Distance between |x| and the next float */
+float ulp(float x) {
+	x = fabs(x);
+	return nextafterf(x, INFINITY) - x;
+}
+
+/**
+ * Latencies of samples luminances from 1e-6 to 1e6 blondels with the scalar
+ * virtual call per sample and with the batch entry point. The batch must be
+ * within maxUlps units in the last place of the scalar latency.
+ */
+bool benchmarkLatencyModel(LatencyModel * model, int samples, float maxUlps) {
+	std::vector<float> intensities(samples);
+	std::vector<float> scalar(samples);
+	std::vector<float> batch(samples);
+
+	srand(1);
+	for (int i=0; i<samples; i++) {
+		intensities[i] = powf(10, -6 + 12.0f * rand() / RAND_MAX);
+	}
+
+	int repeats = 20;
+	BenchmarkTimer timer;
+	for (int r=0; r<repeats; r++) {
+		for (int i=0; i<samples; i++) {
+			scalar[i] = model->pupilLatencyAt(intensities[i]);
+		}
+		doNotOptimize(scalar[0]);
+	}
+	double scalarSeconds = timer.elapsedSeconds();
+
+	timer.restart();
+	for (int r=0; r<repeats; r++) {
+		model->pupilLatencyAt(&intensities[0], &batch[0], samples);
+		doNotOptimize(batch[0]);
+	}
+	double batchSeconds = timer.elapsedSeconds();
+
+	float worstUlps = 0;
+	for (int i=0; i<samples; i++) {
+		worstUlps = std::max(worstUlps, (float) fabs(scalar[i] - batch[i]) / ulp(scalar[i]));
+	}
+
+	std::string name = "latency/" + model->getName();
+	reportBenchmark(name + "/scalar", (double) repeats * samples, scalarSeconds);
+	reportBenchmark(name + "/batch", (double) repeats * samples, batchSeconds);
+	std::cout << name << ": speedup " << scalarSeconds / batchSeconds
+	          << ", max difference " << worstUlps << " ulps"
+	          << (worstUlps <= maxUlps ? "" : " FAILED") << std::endl;
+	return worstUlps <= maxUlps;
+}
+
+/** Latencies (ms) of intensities one by one, repeats times */
+double timeLatencies(LatencyModel & model, const std::vector<float> & intensities, std::vector<float> & latencies, int repeats) {
+	BenchmarkTimer timer;
+	for (int r=0; r<repeats; r++) {
+		for (unsigned int i=0; i<intensities.size(); i++) {
+			latencies[i] = model.pupilLatencyAt(intensities[i]);
+		}
+		doNotOptimize(latencies[0]);
+	}
+	return timer.elapsedSeconds();
+}
+
+/**
+ * A latency model against its TabulatedLatencyModel, one sample at a time
+ * from 1e-6 to 1e6 blondels, at the given Link and Stark frequencies when
+ * tabulated over frequencies. The table must be within maxError ms.
+ */
+bool benchmarkTabulatedLatency(const std::string & name, TabulatedLatencyModel & table,
+                               const std::vector<float> & frequencies, int samples, float maxError) {
+	std::vector<float> intensities(samples);
+	std::vector<float> exact(samples);
+	std::vector<float> tabulated(samples);
+
+	srand(1);
+	for (int i=0; i<samples; i++) {
+		intensities[i] = powf(10, -6 + 12.0f * rand() / RAND_MAX);
+	}
+
+	double exactSeconds = 0;
+	double tableSeconds = 0;
+	float worst = 0;
+	int repeats = 20;
+	for (unsigned int f=0; f<frequencies.size(); f++) {
+		table.setFrequency(frequencies[f]);
+		exactSeconds += timeLatencies(*table.getModel(), intensities, exact, repeats);
+		tableSeconds += timeLatencies(table, intensities, tabulated, repeats);
+		worst = std::max(worst, table.maxError());
+		for (int i=0; i<samples; i++) {
+			worst = std::max(worst, fabsf(tabulated[i] - exact[i]));
+		}
+	}
+
+	double operations = (double) repeats * samples * frequencies.size();
+	reportBenchmark("latency/" + name + "/exact", operations, exactSeconds);
+	reportBenchmark("latency/" + name + "/tabulated", operations, tableSeconds);
+	std::cout << "latency/" << name << ": tables " << exactSeconds / tableSeconds << "x faster, max error "
+	          << worst << " ms" << (worst <= maxError ? "" : " FAILED") << std::endl;
+	return worst <= maxError;
+}
+
+/** Steps of a Moon and Spencer lifecycle every 10 ms through alternating light, per second */
+double lifecycleRate(bool latencyTables, int steps) {
+	PupilLifecycle lifecycle(PupilModelId::MOON_AND_SPENCER, LatencyModelId::LINK_AND_STARK, 0);
+	lifecycle.setLatencyTables(latencyTables);
+
+	BenchmarkTimer timer;
+	for (int i=0; i<steps; i++) {
+		doNotOptimize(lifecycle.getDiameter((i+1) * 10, powf(10, (i / 100) % 2 ? 2 : -2)));
+	}
+	return steps / timer.elapsedSeconds();
+}
+
+/** Model name for benchmark names: "Our Model" gives "our-model" */
+std::string benchmarkSlug(const char * name) {
+	std::string slug;
+	for (; *name; name++) {
+		slug += *name == ' ' ? '-' : (char) tolower(*name);
+	}
+	return slug;
+}
+
+void setSolver(PupilDynamicsModel * model, SolverType solver) {
+	if (PamplonaAndOliveiraModel * m = dynamic_cast<PamplonaAndOliveiraModel *>(model)) m->setSolver(solver);
+	if (PamplonaAndOliveiraWithEnvelopeModel * m = dynamic_cast<PamplonaAndOliveiraWithEnvelopeModel *>(model)) m->setSolver(solver);
+	if (LongtinAndMiltonModel * m = dynamic_cast<LongtinAndMiltonModel *>(model)) m->setSolver(solver);
+}
+
+/**
+ * Steps a model every step ms under 1 blondel (steady) or under a light
+ * switching between 0.01 and 100 blondels every second (response). The
+ * model restarts every 4096 steps, untimed, to keep float times precise.
+ */
+void benchmarkModel(BenchmarkState & state, PupilModelId id, SolverType solver, float step, bool response) {
+	PupilDynamicsModel * model = ModelRegistry::create(id);
+	setSolver(model, solver);
+
+	bool lumens = ModelRegistry::info(id).unit == IntensityUnit::LUMENS_PER_SQUARE_MM;
+	float levels[] = { response ? 0.01f : 1.0f, response ? 100.0f : 1.0f };
+	float start = levels[0];
+	for (int i=0; i<2; i++) {
+		if (lumens) levels[i] = Conversion::blondelToLumensSquareMillimeter(levels[i]);
+	}
+
+	model->setSteadyState(0, start);
+	ModelInstrumentation & instrumentation = model->getInstrumentation();
+	instrumentation.clear();
+
+	float time = 0;
+	long steps = 0;
+	while (state.keepRunning()) {
+		if (++steps % 4096 == 0) {
+			state.pauseTiming();
+			time = 0;
+			model->setSteadyState(0, start);
+			state.resumeTiming();
+		}
+		time += step;
+		doNotOptimize(model->pupilDiameterAt(levels[(int) (time / 1000) % 2], 250, time));
+	}
+
+	if (instrumentation.solves > 0) {
+		state.setCounter("solver_iterations", instrumentation.averageIterations());
+		state.setCounter("max_solver_iterations", instrumentation.maxIterations);
+		state.setCounter("divergences", instrumentation.divergences);
+	}
+	if (dynamic_cast<PamplonaAndOliveiraWithEnvelopeModel *>(model) != NULL) {
+		long rightSides = instrumentation.fluxReused + instrumentation.lookups;
+		state.setCounter("flux_reused", (double) instrumentation.fluxReused / rightSides);
+		state.setCounter("flux_logarithms", (double) instrumentation.fluxLogarithms / rightSides);
+	}
+	delete model;
+}
+
+/**
+ * Latencies of intensities from 0.001 to 1000 blondels, n at once or one by
+ * one when n is 0, read from a TabulatedLatencyModel when tabulated.
+ */
+void benchmarkLatency(BenchmarkState & state, LatencyModelId id, int n, bool tabulated) {
+	LatencyModel * model = ModelRegistry::create(id);
+	if (tabulated) model = new TabulatedLatencyModel(model);
+	int size = n > 0 ? n : 4096;
+	std::vector<float> intensities(size), latencies(size);
+	for (int i=0; i<size; i++) {
+		intensities[i] = powf(10, -3 + 6.0f * i / size);
+	}
+
+	if (n > 0) {
+		while (state.keepRunning()) {
+			model->pupilLatencyAt(&intensities[0], &latencies[0], n);
+			doNotOptimize(latencies[0]);
+		}
+		state.setItemsPerIteration(n);
+	} else {
+		int i = 0;
+		while (state.keepRunning()) {
+			doNotOptimize(model->pupilLatencyAt(intensities[i]));
+			i = (i + 1) % size;
+		}
+	}
+	delete model;
+}
+
+/** Pushes to and lookups anywhere in a full history */
+template <int capacity>
+void addHistoryBenchmarks(BenchmarkSuite & suite) {
+	std::string length = std::to_string(capacity);
+
+	suite.add("history/push/length:" + length, [](BenchmarkState & state) {
+		HistoryFifo<PupilSample, capacity> * history = new HistoryFifo<PupilSample, capacity>();
+		for (int i=0; i<capacity; i++) history->add(PupilSample(i, 1.0f, 2.0f));
+		int i = capacity;
+		while (state.keepRunning()) {
+			history->add(PupilSample(i++, 1.0f, 2.0f));
+		}
+		doNotOptimize(history->last());
+		delete history;
+	});
+
+	suite.add("history/lookup/length:" + length, [](BenchmarkState & state) {
+		HistoryFifo<PupilSample, capacity> * history = new HistoryFifo<PupilSample, capacity>();
+		for (int i=0; i<capacity; i++) history->add(PupilSample(i, 1.0f, 2.0f));
+		long i = 0, found = 0;
+		while (state.keepRunning()) {
+			found += history->lastIndexAtOrBefore(capacity - 0.5 - (i++ * 7919) % capacity);
+		}
+		doNotOptimize(found);
+		delete history;
+	});
+}
+
+/**
+ * getDiameter of pupils lifecycles every frame ms, each seeing its own
+ * sequence of 0.01, 1 and 100 blondels. Restarted every 4096 frames.
+ */
+void benchmarkLifecycles(BenchmarkState & state, PupilModelId id, int pupils, float frame) {
+	std::vector<PupilLifecycle> lifecycles;
+	for (int p=0; p<pupils; p++) {
+		lifecycles.push_back(PupilLifecycle(id, LatencyModelId::LINK_AND_STARK, 0, 1));
+	}
+
+	float time = 0;
+	long frames = 0;
+	while (state.keepRunning()) {
+		if (++frames % 4096 == 0) {
+			state.pauseTiming();
+			time = 0;
+			for (int p=0; p<pupils; p++) {
+				lifecycles[p] = PupilLifecycle(id, LatencyModelId::LINK_AND_STARK, 0, 1);
+			}
+			state.resumeTiming();
+		}
+		time += frame;
+		for (int p=0; p<pupils; p++) {
+			float blondels = powf(10, ((frames / 64 + p) % 3) * 2 - 2);
+			doNotOptimize(lifecycles[p].getDiameter(time, blondels));
+		}
+	}
+	state.setItemsPerIteration(pupils);
+}
+
+/**
+ * The "suite" section: every model, solver and step size, the history
+ * and the lifecycle at several sizes. Names follow Google Benchmark's
+ * "name/parameter:value".
+ */
+void registerSuite(BenchmarkSuite & suite) {
+	int steps[] = { 1, 10, 33, 100 };
+	SolverType solvers[] = { STEP_HALVING_SOLVER, NEWTON_SOLVER };
+	const char * solverNames[] = { "step-halving", "newton" };
+
+	for (int m=0; m<ModelRegistry::PUPIL_MODELS; m++) {
+		PupilModelId id = (PupilModelId) m;
+		std::string name = "model/" + benchmarkSlug(ModelRegistry::info(id).name);
+		int solverCount = ModelRegistry::info(id).stateful ? 2 : 1;
+
+		for (int response=0; response<2; response++) {
+			for (int s=0; s<solverCount; s++) {
+				for (int i=0; i<4; i++) {
+					std::string run = name + (response ? "/response" : "/steady") + "/step:" + std::to_string(steps[i]);
+					if (solverCount > 1) run += std::string("/") + solverNames[s];
+
+					SolverType solver = solvers[s];
+					float step = steps[i];
+					suite.add(run, [=](BenchmarkState & state) {
+						benchmarkModel(state, id, solver, step, response);
+					});
+				}
+			}
+		}
+	}
+
+	int batches[] = { 0, 16, 256, 4096 };
+	for (int m=0; m<ModelRegistry::LATENCY_MODELS; m++) {
+		LatencyModelId id = (LatencyModelId) m;
+		for (int tabulated=0; tabulated<2; tabulated++) {
+			for (int b=0; b<4; b++) {
+				int n = batches[b];
+				std::string name = "latency/" + benchmarkSlug(ModelRegistry::info(id).name)
+				                 + (n > 0 ? "/batch:" + std::to_string(n) : "/scalar") + (tabulated ? "/tabulated" : "");
+				suite.add(name, [=](BenchmarkState & state) {
+					benchmarkLatency(state, id, n, tabulated);
+				});
+			}
+		}
+	}
+
+	addHistoryBenchmarks<1000>(suite);
+	addHistoryBenchmarks<10000>(suite);
+	addHistoryBenchmarks<100000>(suite);
+
+	PupilModelId lifecycleModels[] = { PupilModelId::MOON_AND_SPENCER, PupilModelId::PAMPLONA_AND_OLIVEIRA,
+	                                   PupilModelId::PAMPLONA_AND_OLIVEIRA_WITH_ENVELOPE, PupilModelId::LONGTIN_AND_MILTON };
+	int pupils[] = { 1, 64, 1024 };
+	for (int m=0; m<4; m++) {
+		PupilModelId id = lifecycleModels[m];
+		for (int p=0; p<3; p++) {
+			int n = pupils[p];
+			std::string name = "lifecycle/" + benchmarkSlug(ModelRegistry::info(id).name) + "/pupils:" + std::to_string(n);
+			suite.add(name, [=](BenchmarkState & state) {
+				benchmarkLifecycles(state, id, n, 16);
+			});
+		}
+	}
+}
+
+/** Value of the option --name=value, or fallback */
+std::string option(int argc, char *argv[], const std::string & name, const std::string & fallback) {
+	std::string prefix = "--" + name + "=";
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		if (arg.compare(0, prefix.size(), prefix) == 0) return arg.substr(prefix.size());
+	}
+	return fallback;
+}
+
+/** Sections are the arguments that are not --options; all run when none is given */
+bool shouldRun(int argc, char *argv[], const char * section) {
+	bool any = false;
+	for (int i=1; i<argc; i++) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 2, "--") == 0) continue;
+		if (arg == section) return true;
+		any = true;
+	}
+	return !any;
+}
+
+int main(int argc, char *argv[]) {
+	bool passed = true;
+
+	if (shouldRun(argc, argv, "history")) {
+		benchmarkHistory<1000>("1k");
+		benchmarkHistory<10000>("10k");
+		benchmarkHistory<100000>("100k");
+
+		reportFootprint<PamplonaAndOliveiraModel>("pamplona");
+		reportFootprint<PamplonaAndOliveiraWithEnvelopeModel>("envelope");
+		reportFootprint<LongtinAndMiltonModel>("longtin");
+	}
+
+	if (shouldRun(argc, argv, "batch")) {
+		benchmarkBatch(100, 100);
+		benchmarkBatch(10000, 20);
+	}
+
+	if (shouldRun(argc, argv, "solver")) {
+		benchmarkSolver(100000);
+	}
+
+	if (shouldRun(argc, argv, "iterations")) {
+		SolverType solvers[] = { STEP_HALVING_SOLVER, NEWTON_SOLVER };
+		for (int s=0; s<2; s++) {
+			PamplonaAndOliveiraModel pamplona;
+			PamplonaAndOliveiraWithEnvelopeModel envelope;
+			LongtinAndMiltonModel longtin;
+			benchmarkIterations("pamplona", pamplona, solvers[s]);
+			benchmarkIterations("envelope", envelope, solvers[s]);
+			benchmarkIterations("longtin", longtin, solvers[s]);
+		}
+	}
+
+	if (shouldRun(argc, argv, "integrators")) {
+		// reference: RK4 stepping every millisecond
+		double seconds;
+		std::vector<float> reference = runIntegrator(RK4_INTEGRATOR, 1, seconds);
+
+		reportIntegrator("implicit", IMPLICIT_INTEGRATOR, 1, reference);
+		int steps[] = { 20, 50, 100 };
+		for (int i=0; i<3; i++) {
+			reportIntegrator("implicit", IMPLICIT_INTEGRATOR, steps[i], reference);
+			reportIntegrator("rk4", RK4_INTEGRATOR, steps[i], reference);
+			reportIntegrator("exponential", EXPONENTIAL_INTEGRATOR, steps[i], reference);
+		}
+	}
+
+	if (shouldRun(argc, argv, "tables")) {
+		PamplonaAndOliveiraWithEnvelopeModel moon;
+		LongtinAndMiltonModel hill;
+
+		benchmarkTable("m", LookupTables::mTable(), exactM,
+		               [](float d) { return PamplonaAndOliveiraModel::m(d); });
+		benchmarkTable("moon-upper", LookupTables::moonUpperTable(), TabulatedFunctions::moonUpperBound,
+		               [&](float d) { return moon.evaluateMoonUpperBound(d); });
+		benchmarkTable("moon-lower", LookupTables::moonLowerTable(), TabulatedFunctions::moonLowerBound,
+		               [&](float d) { return moon.evaluateMoonLowerBound(d); });
+		benchmarkTable("hill-inverse", LookupTables::hillInverseTable(), exactHillFunctionInverse,
+		               [&](float a) { return hill.hillFunctionInverse(a); });
+
+		SolverType solvers[] = { STEP_HALVING_SOLVER, NEWTON_SOLVER };
+		for (int s=0; s<2; s++) {
+			for (int tables=0; tables<2; tables++) {
+				PamplonaAndOliveiraModel pamplona;
+				PamplonaAndOliveiraWithEnvelopeModel envelope;
+				LongtinAndMiltonModel longtin;
+				pamplona.setLookupTables(tables);
+				envelope.setLookupTables(tables);
+				envelope.setWithEnvelope(true);
+				longtin.setLookupTables(tables);
+				std::string suffix = tables ? "+tables" : "";
+				benchmarkIterations("pamplona" + suffix, pamplona, solvers[s]);
+				benchmarkIterations("envelope" + suffix, envelope, solvers[s]);
+				benchmarkIterations("longtin" + suffix, longtin, solvers[s]);
+			}
+		}
+	}
+
+	if (shouldRun(argc, argv, "allocations")) {
+		SolverType solvers[] = { STEP_HALVING_SOLVER, NEWTON_SOLVER };
+		const char * solverNames[] = { "step-halving", "newton" };
+		for (int s=0; s<2; s++) {
+			PamplonaAndOliveiraModel pamplona;
+			PamplonaAndOliveiraModel rk4;
+			PamplonaAndOliveiraWithEnvelopeModel envelope;
+			LongtinAndMiltonModel longtin;
+			pamplona.setSolver(solvers[s]);
+			rk4.setIntegrator(RK4_INTEGRATOR);
+			envelope.setSolver(solvers[s]);
+			envelope.setWithEnvelope(true);
+			longtin.setSolver(solvers[s]);
+
+			std::string suffix = std::string("/") + solverNames[s];
+			passed &= checkAllocations("pamplona" + suffix, pamplona);
+			passed &= checkAllocations("envelope" + suffix, envelope);
+			passed &= checkAllocations("longtin" + suffix, longtin);
+			if (s == 0) passed &= checkAllocations("pamplona/rk4", rk4);
+		}
+	}
+
+	if (shouldRun(argc, argv, "threads")) {
+		int cores = sysconf(_SC_NPROCESSORS_ONLN);
+		std::cout << "threads: " << cores << " cores online" << std::endl;
+
+		double singleThreadRate = 0;
+		for (int threads = 1; threads <= 2 * cores; threads *= 2) {
+			benchmarkThreads(threads, 8, 2000, singleThreadRate);
+		}
+		if (cores > 1 && (cores & (cores - 1)) != 0) {
+			benchmarkThreads(cores, 8, 2000, singleThreadRate);
+		}
+	}
+
+	if (shouldRun(argc, argv, "scheduler")) {
+		int cores = sysconf(_SC_NPROCESSORS_ONLN);
+		int threads[] = { cores, 4 };
+		for (int t=0; t<(cores == 4 ? 1 : 2); t++) {
+			std::vector<float> fixed = benchmarkScheduler(threads[t], 1024, 100, false);
+			std::vector<float> stealing = benchmarkScheduler(threads[t], 1024, 100, true);
+			std::cout << "scheduler/" << threads[t] << ": stealing and static results "
+			          << (fixed == stealing ? "match" : "DIFFER") << std::endl;
+		}
+	}
+
+	if (shouldRun(argc, argv, "soak")) {
+		benchmarkSoak(10000000);
+	}
+
+	if (shouldRun(argc, argv, "lifecycle")) {
+		benchmarkLifecycle("moon", PupilModelId::MOON_AND_SPENCER, LatencyModelId::LINK_AND_STARK,
+		                   MoonAndSpencerModel(), LinkAndStarkModel(0.4), 1000000);
+		benchmarkLifecycle("pokorny", PupilModelId::POKORNY_AND_SMITH, LatencyModelId::ELLIS,
+		                   PokornyAndSmithModel(), EllisModel(), 1000000);
+		benchmarkLifecycle("pamplona", PupilModelId::PAMPLONA_AND_OLIVEIRA, LatencyModelId::LINK_AND_STARK,
+		                   PamplonaAndOliveiraModel(), LinkAndStarkModel(0.4), 100000);
+		benchmarkLifecycle("longtin", PupilModelId::LONGTIN_AND_MILTON, LatencyModelId::ELLIS,
+		                   LongtinAndMiltonModel(), EllisModel(), 100000);
+	}
+
+	if (shouldRun(argc, argv, "static")) {
+		PupilModelId ids[] = { PupilModelId::MOON_AND_SPENCER, PupilModelId::DEGROOT_AND_GEBHARD,
+		                       PupilModelId::REEVES, PupilModelId::POKORNY_AND_SMITH };
+		for (int m=0; m<4; m++) {
+			PupilDynamicsModel * model = ModelRegistry::create(ids[m]);
+			benchmarkStaticModel(model, 1 << 16);
+			delete model;
+		}
+	}
+
+	if (shouldRun(argc, argv, "latency")) {
+		LatencyModelId ids[] = { LatencyModelId::LINK_AND_STARK, LatencyModelId::ELLIS };
+		for (int m=0; m<2; m++) {
+			LatencyModel * model = ModelRegistry::create(ids[m]);
+			passed &= benchmarkLatencyModel(model, 1 << 16, 1);
+
+			TabulatedLatencyModel table(ModelRegistry::create(ids[m]));
+			passed &= benchmarkTabulatedLatency(benchmarkSlug(model->getName().c_str()), table, std::vector<float>(1, 0), 1 << 16, 0.05f);
+			delete model;
+		}
+
+		// 0.1 to 4.9 Hz, between the tabulated frequencies
+		std::vector<float> frequencies;
+		for (int f=1; f<50; f+=4) frequencies.push_back(f * 0.1f);
+		TabulatedLatencyModel frequencyTable(new LinkAndStarkModel(0.4), 5);
+		passed &= benchmarkTabulatedLatency("link-and-stark/frequencies", frequencyTable, frequencies, 1 << 16, 0.05f);
+
+		double exactRate = lifecycleRate(false, 1000000);
+		double tableRate = lifecycleRate(true, 1000000);
+		std::cout << "latency/lifecycle: " << exactRate << " steps/s, " << tableRate << " with tables, "
+		          << tableRate / exactRate << "x" << std::endl;
+	}
+
+	if (shouldRun(argc, argv, "trace")) {
+		passed &= benchmarkTrace(200000, 16000000);
+	}
+
+	if (shouldRun(argc, argv, "checkpoint")) {
+		passed &= benchmarkCheckpoint("pamplona", PupilModelId::PAMPLONA_AND_OLIVEIRA, 200, 2000);
+		passed &= benchmarkCheckpoint("envelope", PupilModelId::PAMPLONA_AND_OLIVEIRA_WITH_ENVELOPE, 200, 2000);
+		passed &= benchmarkCheckpoint("longtin", PupilModelId::LONGTIN_AND_MILTON, 200, 2000);
+
+		// a model snapshot restores into a new model of the same kind only
+		PamplonaAndOliveiraModel model;
+		model.addPulse(0, 1, 20);
+		std::vector<char> blob;
+		ModelCheckpoint::save(model, PupilModelId::PAMPLONA_AND_OLIVEIRA, blob);
+		PupilDynamicsModel * copy = ModelCheckpoint::restore(blob);
+		LongtinAndMiltonModel other;
+		bool valid = copy != NULL && !ModelCheckpoint::restore(blob, other, PupilModelId::LONGTIN_AND_MILTON);
+		blob.pop_back();
+		valid &= ModelCheckpoint::restore(blob) == NULL;
+		delete copy;
+
+		// a snapshot with a byte too many or a truncated history leaves a
+		// lifecycle as it was
+		PupilLifecycle adapted(PupilModelId::PAMPLONA_AND_OLIVEIRA, LatencyModelId::LINK_AND_STARK, 0);
+		stepLifecycle(adapted, 1, 200, 100);
+		std::vector<char> longer, shorter;
+		adapted.checkpoint(longer);
+		longer.push_back(0);
+		ModelCheckpoint::finish(longer);
+		adapted.checkpoint(shorter);
+		shorter.resize(shorter.size() - 4);
+		ModelCheckpoint::finish(shorter);
+
+		PupilLifecycle kept(PupilModelId::LONGTIN_AND_MILTON, LatencyModelId::ELLIS, 0);
+		PupilLifecycle twin(PupilModelId::LONGTIN_AND_MILTON, LatencyModelId::ELLIS, 0);
+		stepLifecycle(kept, 1, 200, 1);
+		stepLifecycle(twin, 1, 200, 1);
+		valid &= !kept.restore(longer) && !kept.restore(shorter);
+		valid &= kept.getPupilModelId() == PupilModelId::LONGTIN_AND_MILTON && kept.getLatencyModelId() == LatencyModelId::ELLIS;
+		valid &= stepLifecycle(kept, 201, 300, 100) == stepLifecycle(twin, 201, 300, 100);
+
+		// an out of range solver or interpolation, or a NaN step, is
+		// rejected before the model changes
+		PamplonaAndOliveiraModel stepped;
+		stepped.setSolver(NEWTON_SOLVER);
+		stepped.setSteadyState(0, 1);
+		std::vector<char> snapshot, before, after;
+		ModelCheckpoint::save(stepped, PupilModelId::PAMPLONA_AND_OLIVEIRA, snapshot);
+		PamplonaAndOliveiraModel target;
+		target.setSteadyState(0, 100);
+		ModelCheckpoint::save(target, PupilModelId::PAMPLONA_AND_OLIVEIRA, before);
+		// dt (float), threshold (double), solver (int32), integrator (int32),
+		// tables and interpolation (uint8) follow the header and the id
+		size_t fields = ModelCheckpoint::HEADER_SIZE + 1;
+		size_t offsets[] = { fields + 12, fields + 16, fields + 21, fields + 3 };
+		char bytes[] = { 7, 7, 2, (char) 0xff };
+		for (int c=0; c<4; c++) {
+			std::vector<char> corrupt = snapshot;
+			corrupt[offsets[c]] = bytes[c];
+			if (c == 3) corrupt[offsets[c] - 1] = (char) 0xff;	// dt becomes a NaN
+			valid &= !ModelCheckpoint::restore(corrupt, target, PupilModelId::PAMPLONA_AND_OLIVEIRA);
+		}
+		ModelCheckpoint::save(target, PupilModelId::PAMPLONA_AND_OLIVEIRA, after);
+		valid &= before == after && ModelCheckpoint::restore(snapshot, target, PupilModelId::PAMPLONA_AND_OLIVEIRA);
+		std::cout << "checkpoint/validation: " << (valid ? "ok" : "FAILED") << std::endl;
+		passed &= valid;
+	}
+
+	if (shouldRun(argc, argv, "steady")) {
+		benchmarkSteadyState("pamplona", PupilModelId::PAMPLONA_AND_OLIVEIRA, 10000);
+		benchmarkSteadyState("envelope", PupilModelId::PAMPLONA_AND_OLIVEIRA_WITH_ENVELOPE, 10000);
+		benchmarkSteadyState("longtin", PupilModelId::LONGTIN_AND_MILTON, 10000);
+	}
+
+	if (shouldRun(argc, argv, "adaptive")) {
+		benchmarkAdaptive(100);
+		benchmarkAdaptive(33);
+		passed &= validateAdaptiveTrace();
+	}
+
+	if (shouldRun(argc, argv, "delay")) {
+		benchmarkDelayLookup(1000000);
+		benchmarkDelayInterpolation();
+	}
+
+	if (shouldRun(argc, argv, "archive")) {
+		float steps[] = { 100, 10, 1, 0.1f };
+		for (int s=0; s<4; s++) {
+			benchmarkArchiveLookup(steps[s], 1000000);
+		}
+		benchmarkArchiveAccuracy();
+	}
+
+	if (shouldRun(argc, argv, "envelope")) {
+		benchmarkEnvelopeBreakdown(1000000);
+	}
+
+	if (shouldRun(argc, argv, "instrumentation")) {
+		benchmarkInstrumentation<PamplonaAndOliveiraModel>("pamplona", NEWTON_SOLVER, 1000000);
+		benchmarkInstrumentation<PamplonaAndOliveiraWithEnvelopeModel>("envelope", NEWTON_SOLVER, 1000000);
+		benchmarkInstrumentation<LongtinAndMiltonModel>("longtin", NEWTON_SOLVER, 1000000);
+		benchmarkInstrumentation<LongtinAndMiltonModel>("longtin/step-halving", STEP_HALVING_SOLVER, 100000);
+		passed &= validateInstrumentationJson();
+	}
+
+	if (shouldRun(argc, argv, "suite")) {
+		BenchmarkSuite & suite = BenchmarkSuite::global();
+		suite.setMinSeconds(atof(option(argc, argv, "min-time", "0.1").c_str()));
+		registerSuite(suite);
+		suite.run(option(argc, argv, "filter", ""));
+	}
+
+	std::string json = option(argc, argv, "json", "");
+	if (!json.empty()) {
+		std::ofstream out(json.c_str());
+		BenchmarkSuite::global().writeJson(out);
+		passed &= out.good();
+	}
+
+	return passed ? 0 : 1;
+}
@@ -1,5 +1,7 @@
 #include "PupilLifecycle.h"
 
+#include <chrono>
+
 float pupilDiameterInMM = 7.1; // Starts with a large pupil
 float lightIntensityInBlondels = -2; // Light intensity reaching the retina
 float timeInMilliseconds = 100; // time
@@ -17,8 +19,96 @@ float evaluateDiameter() {
     return pupilDiameterInMM;
 }
 
+void usage() {
+    std::cerr << "Usage: PLRModel [--pupil model] [--latency model] [--binary] [--trace file] stimulus [diameters]" << std::endl
+              << "  Streams a CSV or binary (time ms, intensity blondels) trace through the" << std::endl
+              << "  models and writes (time ms, diameter mm) to diameters or to the standard" << std::endl
+              << "  output, as CSV or, with --binary, as floats. --trace also writes every" << std::endl
+              << "  step to a binary PupilTrace file. Models by name or id:" << std::endl;
+    for (int i=0; i<ModelRegistry::PUPIL_MODELS; i++)
+        std::cerr << "  pupil " << i << ": " << ModelRegistry::pupilModels[i].name << std::endl;
+    for (int i=0; i<ModelRegistry::LATENCY_MODELS; i++)
+        std::cerr << "  latency " << i << ": " << ModelRegistry::latencyModels[i].name << std::endl;
+}
+
+int replay(int argc, char *argv[]) {
+    PupilModelId pupilModel = PupilModelId::PAMPLONA_AND_OLIVEIRA;
+    LatencyModelId latencyModel = LatencyModelId::LINK_AND_STARK;
+    bool binary = false;
+    const char * input = NULL;
+    const char * output = NULL;
+    const char * tracePath = NULL;
+
+    for (int i=1; i<argc; i++) {
+        std::string argument = argv[i];
+        if (argument == "--pupil" && i+1 < argc) {
+            if (!ModelRegistry::find(argv[++i], pupilModel)) { usage(); return 1; }
+        } else if (argument == "--latency" && i+1 < argc) {
+            if (!ModelRegistry::find(argv[++i], latencyModel)) { usage(); return 1; }
+        } else if (argument == "--trace" && i+1 < argc) {
+            tracePath = argv[++i];
+        } else if (argument == "--binary") {
+            binary = true;
+        } else if (input == NULL && argument[0] != '-') {
+            input = argv[i];
+        } else if (output == NULL && argument[0] != '-') {
+            output = argv[i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (input == NULL) { usage(); return 1; }
+
+    StimulusTrace trace;
+    if (!trace.open(input)) {
+        std::cerr << input << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    int file = output == NULL ? STDOUT_FILENO : open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) {
+        std::cerr << output << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    PupilTraceWriter traceWriter;
+    if (tracePath != NULL && !traceWriter.open(tracePath)) {
+        std::cerr << tracePath << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    long samples;
+    {
+        DiameterTraceWriter writer(file, binary);
+        samples = replayStimulusTrace(trace, writer, pupilModel, latencyModel,
+                                      tracePath != NULL ? &traceWriter : NULL);
+    }
+    bool traceWritten = traceWriter.close();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bool outputWritten = samples >= 0 && (output == NULL || close(file) == 0);
+
+    if (!outputWritten) {
+        std::cerr << (output != NULL ? output : "stdout") << ": could not write the diameters" << std::endl;
+        return 1;
+    }
+    if (!traceWritten) {
+        std::cerr << tracePath << ": could not write the trace" << std::endl;
+        return 1;
+    }
+
+    std::cerr << samples << " samples through " << ModelRegistry::info(pupilModel).name
+              << " and " << ModelRegistry::info(latencyModel).name << " in " << seconds << " s, "
+              << samples / seconds << " samples/s" << std::endl;
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
 
+    // Replays a recorded trace, see usage()
+    if (argc > 1) return replay(argc, argv);
+
     // Fill t<0 data. 
     for (int i=0; i<10; i ++) {
  	 model.addPulse(timeInMilliseconds, getIntensityInLumens(), Conversion::diameterToArea(pupilDiameterInMM));